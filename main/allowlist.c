@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "allowlist.h"
+#include "motion.h"
+
+static const char *TAG = "ALLOWLIST";
+
+static uint32_t lists[2][ALLOWLIST_CAPACITY];    /* Live list and multi-part staging */
+static uint32_t *hashes = lists[0];
+static size_t hash_count = 0;
+static uint32_t list_seq = 0;
+
+/* Multi-part replace in progress; MQTT task only */
+static struct {
+    bool active;
+    uint32_t seq;
+    uint8_t next;                           /* Part expected next */
+    uint8_t parts;
+    size_t count;
+} staging;
+static SemaphoreHandle_t list_lock;
+static StaticSemaphore_t list_lock_buffer;
+/* Held by the persist task across the NVS write; the MQTT task takes it to change the list */
+static SemaphoreHandle_t persist_lock;
+static StaticSemaphore_t persist_lock_buffer;
+static TaskHandle_t persist_task_handle;
+static StaticTask_t persist_task_buffer;
+static StackType_t persist_task_stack[ALLOWLIST_TASK_STACK_SIZE];
+
+static inline uint32_t read_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Function to find the first index whose hash is not below the key */
+static size_t lower_bound(uint32_t hash)
+{
+    size_t lo = 0, hi = hash_count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (hashes[mid] < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Function to write the list and its sequence number. The MQTT task changes the list
+ * only under persist_lock, so lookups keep running on list_lock during the write. */
+static void allowlist_persist(void)
+{
+    nvs_handle_t nvs;
+
+    if (nvs_open(ALLOWLIST_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        ESP_LOGW(TAG, "[WARN] Could not open NVS, list kept in RAM only.");
+        return;
+    }
+    /* Hashes before seq: a reset between the two writes only costs a resync */
+    if (nvs_set_blob(nvs, "hashes", hashes, hash_count * sizeof(hashes[0])) != ESP_OK ||
+        nvs_set_u32(nvs, "seq", list_seq) != ESP_OK || nvs_commit(nvs) != ESP_OK) {
+        ESP_LOGW(TAG, "[WARN] Could not persist the allow-list.");
+    }
+    nvs_close(nvs);
+}
+
+/* Persist task: writes the list after each applied sync, once no gate is moving. Syncs
+ * applied while it waits are covered by the same write. */
+static void allowlist_persist_task(void *pvParameters)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        while (motion_busy() != 0) {
+            vTaskDelay(pdMS_TO_TICKS(ALLOWLIST_BUSY_POLL_MS));
+        }
+        xSemaphoreTake(persist_lock, portMAX_DELAY);
+        ulTaskNotifyTake(pdTRUE, 0);        /* Everything applied so far is in this write */
+        allowlist_persist();
+        xSemaphoreGive(persist_lock);
+    }
+}
+
+void allowlist_init(void)
+{
+    nvs_handle_t nvs;
+    size_t len = sizeof(lists[0]);
+
+    list_lock = xSemaphoreCreateMutexStatic(&list_lock_buffer);
+    persist_lock = xSemaphoreCreateMutexStatic(&persist_lock_buffer);
+    persist_task_handle = xTaskCreateStatic(allowlist_persist_task, "allowlist", ALLOWLIST_TASK_STACK_SIZE, NULL,
+                                            ALLOWLIST_TASK_PRIORITY, persist_task_stack, &persist_task_buffer);
+    if (nvs_open(ALLOWLIST_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;                             /* Never synced */
+    }
+    if (nvs_get_blob(nvs, "hashes", hashes, &len) == ESP_OK && nvs_get_u32(nvs, "seq", &list_seq) == ESP_OK) {
+        hash_count = len / sizeof(hashes[0]);
+    } else {
+        hash_count = 0;
+        list_seq = 0;
+    }
+    nvs_close(nvs);
+    ESP_LOGI(TAG, "[INIT] %u credentials loaded (sync %lu).", (unsigned)hash_count, (unsigned long)list_seq);
+}
+
+bool allowlist_contains(uint32_t hash)
+{
+    bool found;
+
+    xSemaphoreTake(list_lock, portMAX_DELAY);
+    size_t i = lower_bound(hash);
+    found = i < hash_count && hashes[i] == hash;
+    xSemaphoreGive(list_lock);
+    return found;
+}
+
+/* Function to stage one part of a multi-part replace; the list swaps on the last part */
+static allowlist_sync_t allowlist_stage(uint32_t seq, uint16_t count, const uint8_t *data, size_t len)
+{
+    uint8_t part, parts;
+    uint32_t *staged;
+
+    if (len < ALLOWLIST_PART_HEADER_LEN || len != ALLOWLIST_PART_HEADER_LEN + (size_t)count * 4) {
+        return ALLOWLIST_SYNC_INVALID;
+    }
+    part = data[ALLOWLIST_HEADER_LEN];
+    parts = data[ALLOWLIST_HEADER_LEN + 1];
+    data += ALLOWLIST_PART_HEADER_LEN;
+    if (parts == 0 || part >= parts) {
+        return ALLOWLIST_SYNC_INVALID;
+    }
+    if (part == 0) {
+        if (seq <= list_seq) {
+            return ALLOWLIST_SYNC_STALE;    /* A redelivered or reordered older replace */
+        }
+        staging.active = true;
+        staging.seq = seq;
+        staging.next = 0;
+        staging.parts = parts;
+        staging.count = 0;
+    } else if (!staging.active && seq == list_seq) {
+        return ALLOWLIST_SYNC_STALE;        /* A redelivered part of the replace already applied */
+    }
+    if (!staging.active || seq != staging.seq || part != staging.next || parts != staging.parts ||
+        count > ALLOWLIST_CAPACITY - staging.count) {
+        staging.active = false;
+        return ALLOWLIST_SYNC_GAP;
+    }
+
+    /* The staging buffer is never read by lookups, so no lock until the swap */
+    staged = hashes == lists[0] ? lists[1] : lists[0];
+    for (size_t i = 0; i < count; i++) {
+        staged[staging.count + i] = read_u32(data + i * 4);
+    }
+    staging.count += count;
+    if (++staging.next != staging.parts) {
+        return ALLOWLIST_SYNC_STAGED;
+    }
+    staging.active = false;
+    qsort(staged, staging.count, sizeof(staged[0]), compare_u32);
+
+    xSemaphoreTake(list_lock, portMAX_DELAY);
+    hashes = staged;
+    hash_count = staging.count;
+    list_seq = seq;
+    xSemaphoreGive(list_lock);
+    return ALLOWLIST_SYNC_APPLIED;
+}
+
+allowlist_sync_t allowlist_sync(const uint8_t *data, size_t len)
+{
+    allowlist_sync_t result;
+    uint32_t seq;
+    uint8_t op;
+    uint16_t count;
+
+    if (len < ALLOWLIST_HEADER_LEN) {
+        return ALLOWLIST_SYNC_INVALID;
+    }
+    seq = read_u32(data);
+    op = data[4];
+    count = (uint16_t)(data[5] | (data[6] << 8));
+    if (op == ALLOWLIST_OP_REPLACE_PART) {
+        xSemaphoreTake(persist_lock, portMAX_DELAY);
+        result = allowlist_stage(seq, count, data, len);
+        xSemaphoreGive(persist_lock);
+        if (result == ALLOWLIST_SYNC_APPLIED) {
+            xTaskNotifyGive(persist_task_handle);
+        }
+        return result;
+    }
+    if (len != ALLOWLIST_HEADER_LEN + (size_t)count * 4 ||
+        (op != ALLOWLIST_OP_REPLACE && op != ALLOWLIST_OP_ADD && op != ALLOWLIST_OP_DELETE)) {
+        return ALLOWLIST_SYNC_INVALID;
+    }
+    data += ALLOWLIST_HEADER_LEN;
+
+    /* Only blocks if the persist task is mid-write, which a sync rarely meets */
+    xSemaphoreTake(persist_lock, portMAX_DELAY);
+    xSemaphoreTake(list_lock, portMAX_DELAY);
+    if (seq <= list_seq || (op != ALLOWLIST_OP_REPLACE && seq != list_seq + 1)) {
+        /* A replace may skip ahead, but never go back to an older list */
+        result = seq <= list_seq ? ALLOWLIST_SYNC_STALE : ALLOWLIST_SYNC_GAP;
+        xSemaphoreGive(list_lock);
+        xSemaphoreGive(persist_lock);
+        return result;
+    }
+    /* Any other sync supersedes a half-received replace */
+    staging.active = false;
+
+    if (op == ALLOWLIST_OP_REPLACE) {
+        if (count > ALLOWLIST_CAPACITY) {
+            xSemaphoreGive(list_lock);
+            xSemaphoreGive(persist_lock);
+            return ALLOWLIST_SYNC_INVALID;
+        }
+        for (size_t i = 0; i < count; i++) {
+            hashes[i] = read_u32(data + i * 4);
+        }
+        hash_count = count;
+        qsort(hashes, hash_count, sizeof(hashes[0]), compare_u32);
+    } else {
+        for (size_t n = 0; n < count; n++) {
+            uint32_t hash = read_u32(data + n * 4);
+            size_t i = lower_bound(hash);
+            bool present = i < hash_count && hashes[i] == hash;
+
+            if (op == ALLOWLIST_OP_ADD && !present) {
+                if (hash_count == ALLOWLIST_CAPACITY) {
+                    /* Keep what fits; the backend sees the shortfall on the next full sync */
+                    ESP_LOGW(TAG, "[WARN] Allow-list full, credential dropped.");
+                    continue;
+                }
+                memmove(&hashes[i + 1], &hashes[i], (hash_count - i) * sizeof(hashes[0]));
+                hashes[i] = hash;
+                hash_count++;
+            } else if (op == ALLOWLIST_OP_DELETE && present) {
+                memmove(&hashes[i], &hashes[i + 1], (hash_count - i - 1) * sizeof(hashes[0]));
+                hash_count--;
+            }
+        }
+    }
+    list_seq = seq;
+    xSemaphoreGive(list_lock);
+    xSemaphoreGive(persist_lock);
+
+    /* The 8 KB blob write waits for the gates on the persist task, not here */
+    xTaskNotifyGive(persist_task_handle);
+    return ALLOWLIST_SYNC_APPLIED;
+}
+
+uint32_t allowlist_seq(void)
+{
+    uint32_t seq;
+
+    xSemaphoreTake(list_lock, portMAX_DELAY);
+    seq = list_seq;
+    xSemaphoreGive(list_lock);
+    return seq;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sched.h"
+
+/* Local allow-list of permitted plate/ticket credentials, so a gate can decide an open
+ * without a broker round trip. Credentials are stored as 32-bit FNV-1a hashes of the
+ * plate or ticket string (the backend must hash the same way) in a sorted array,
+ * searched in O(log n), and persisted to NVS.
+ *
+ * Sync messages on MQTT_TOPIC_ALLOWLIST, little endian:
+ *   <seq u32> <op u8> <count u16> [<part u8> <parts u8>] <hash u32> * count
+ * op 'R' replaces the list in one message, 'A' adds and 'D' deletes. A delta is applied
+ * only if seq is exactly one past the current one; otherwise a resync is requested. A
+ * replace may skip ahead but is dropped as stale at or below the current seq.
+ *
+ * No message may exceed ALLOWLIST_MESSAGE_MAX (the MQTT reassembly arena), about 500
+ * hashes, so a larger full sync is sent as op 'P': parts 0 .. parts-1 in order, all
+ * under the new seq, each carrying the part header. Parts are staged beside the live
+ * list, which keeps answering lookups, and the staged list replaces it when the last
+ * part arrives. A part out of order drops the staged list and requests a resync. */
+#define ALLOWLIST_CAPACITY 2048             /* Credentials held (8 KB, twice with staging) */
+#define ALLOWLIST_NVS_NAMESPACE "allowlist"
+#define ALLOWLIST_MESSAGE_MAX 2048          /* Largest sync message, must fit the MQTT arena */
+#define ALLOWLIST_HEADER_LEN 7              /* seq, op, count */
+#define ALLOWLIST_PART_HEADER_LEN (ALLOWLIST_HEADER_LEN + 2)
+#define ALLOWLIST_PART_HASHES ((ALLOWLIST_MESSAGE_MAX - ALLOWLIST_PART_HEADER_LEN) / 4)
+#define ALLOWLIST_PARTS_MAX 255
+#define ALLOWLIST_BUSY_POLL_MS 100          /* Retry interval for the NVS write while a gate moves */
+#define ALLOWLIST_TASK_STACK_SIZE 2560
+#define ALLOWLIST_TASK_PRIORITY SCHED_PRIORITY_JOURNAL
+
+_Static_assert(ALLOWLIST_CAPACITY <= ALLOWLIST_PART_HASHES * ALLOWLIST_PARTS_MAX,
+               "A full list must fit a multi-part replace");
+
+#define ALLOWLIST_OP_REPLACE 'R'
+#define ALLOWLIST_OP_REPLACE_PART 'P'
+#define ALLOWLIST_OP_ADD 'A'
+#define ALLOWLIST_OP_DELETE 'D'
+
+typedef enum {
+    ALLOWLIST_SYNC_APPLIED,
+    ALLOWLIST_SYNC_STAGED,                  /* Part of a multi-part replace, more to come */
+    ALLOWLIST_SYNC_STALE,                   /* Already have this sequence number */
+    ALLOWLIST_SYNC_GAP,                     /* Missed a delta: ask for a full sync */
+    ALLOWLIST_SYNC_INVALID,                 /* Malformed, or would overflow the list */
+} allowlist_sync_t;
+
+/* Function to hash a credential string the way the backend does */
+static inline uint32_t allowlist_hash(const char *token, size_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)token[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/* Function to load the persisted list; call once at boot */
+void allowlist_init(void);
+
+/* Function to check a credential hash; safe from any task, never blocks on I/O */
+bool allowlist_contains(uint32_t hash);
+
+/* Function to apply one sync message; MQTT task only. The result is persisted in the
+ * background once no gate is moving, so a reset before that only costs a resync. */
+allowlist_sync_t allowlist_sync(const uint8_t *data, size_t len);
+
+/* Function to get the sequence number of the last applied sync, 0 if none */
+uint32_t allowlist_seq(void);
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "boot.h"
+
+static const char *boot_phase_names[BOOT_PHASE_COUNT] = {
+    [BOOT_PHASE_START] = "start",
+    [BOOT_PHASE_NVS_READY] = "nvs_ready",
+    [BOOT_PHASE_WIFI_STARTED] = "wifi_started",
+    [BOOT_PHASE_CONFIG_LOADED] = "config_loaded",
+    [BOOT_PHASE_SERVO_READY] = "servo_ready",
+    [BOOT_PHASE_MQTT_CLIENT_READY] = "mqtt_client_ready",
+    [BOOT_PHASE_WIFI_GOT_IP] = "wifi_got_ip",
+    [BOOT_PHASE_MQTT_CONNECTED] = "mqtt_connected",
+    [BOOT_PHASE_READY] = "ready",
+    [BOOT_PHASE_FIRST_OPEN] = "first_open",
+};
+
+static volatile int64_t boot_us[BOOT_PHASE_COUNT];
+static portMUX_TYPE boot_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void boot_mark(boot_phase_t phase)
+{
+    int64_t now_us;
+    bool first;
+
+    if (boot_us[phase] != 0) {
+        return;
+    }
+    now_us = esp_timer_get_time();
+    portENTER_CRITICAL(&boot_lock);
+    first = boot_us[phase] == 0;
+    if (first) {
+        boot_us[phase] = now_us;
+    }
+    portEXIT_CRITICAL(&boot_lock);
+    if (!first) {
+        return;
+    }
+
+    /* BOOTLOG,<log ms>,<phase>,<us since boot> */
+    printf("BOOTLOG,%lu,%s,%lld\n",
+        (unsigned long)esp_log_timestamp(),
+        boot_phase_names[phase],
+        (long long)now_us);
+
+    /* BOOTHEAP,<log ms>,<free>,<min free>: the heap once everything is allocated, in every
+     * build, so builds without telemetry (and its MEMLOG rows) can still be compared */
+    if (phase == BOOT_PHASE_READY) {
+        printf("BOOTHEAP,%lu,%lu,%lu\n",
+            (unsigned long)esp_log_timestamp(),
+            (unsigned long)esp_get_free_heap_size(),
+            (unsigned long)esp_get_minimum_free_heap_size());
+    }
+}
+
+int64_t boot_phase_us(boot_phase_t phase)
+{
+    int64_t us;
+
+    portENTER_CRITICAL(&boot_lock);
+    us = boot_us[phase];
+    portEXIT_CRITICAL(&boot_lock);
+    return us;
+}
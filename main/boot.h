@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Boot milestones, in the order they are normally reached. Wi-Fi association runs
+ * concurrently with config, servo and MQTT client setup, so the middle ones interleave. */
+typedef enum {
+    BOOT_PHASE_START,
+    BOOT_PHASE_NVS_READY,
+    BOOT_PHASE_WIFI_STARTED,        /* esp_wifi_start() returned, association in progress */
+    BOOT_PHASE_CONFIG_LOADED,
+    BOOT_PHASE_SERVO_READY,
+    BOOT_PHASE_MQTT_CLIENT_READY,   /* Client constructed, waiting for an IP */
+    BOOT_PHASE_WIFI_GOT_IP,
+    BOOT_PHASE_MQTT_CONNECTED,
+    BOOT_PHASE_READY,               /* Subscribed (or session resumed): commands can arrive */
+    BOOT_PHASE_FIRST_OPEN,          /* First gate open after boot */
+    BOOT_PHASE_COUNT,
+} boot_phase_t;
+
+/* Function to timestamp a phase the first time it is reached and print it as a
+ * BOOTLOG line, plus a BOOTHEAP line at READY; later calls are a single load. Safe from
+ * any task. */
+void boot_mark(boot_phase_t phase);
+
+/* Function to get when a phase was reached in esp_timer microseconds, 0 if not yet */
+int64_t boot_phase_us(boot_phase_t phase);
@@ -0,0 +1,160 @@
+#include <string.h>
+#include "command.h"
+#include "allowlist.h"
+
+/* Function to compare a span against a token, length first so prefixes never match */
+static inline bool command_token(const char *p, size_t len, const char *token, size_t token_len)
+{
+    return len == token_len && memcmp(p, token, len) == 0;
+}
+
+/* Function to parse 1..10 decimal digits into a value no larger than max */
+static bool command_number(const char *p, size_t len, uint32_t max, uint32_t *out)
+{
+    uint64_t value = 0;
+
+    if (len == 0 || len > 10) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] < '0' || p[i] > '9') {
+            return false;
+        }
+        value = value * 10 + (uint32_t)(p[i] - '0');
+    }
+    if (value > max) {
+        return false;
+    }
+    *out = (uint32_t)value;
+    return true;
+}
+
+static inline uint32_t command_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Function to check that a token is a plausible plate or ticket: letters, digits, '-' */
+static bool command_credential(const char *p, size_t len)
+{
+    if (len == 0 || len > COMMAND_TOKEN_MAX_LEN) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = p[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '-')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool command_parse_binary(const uint8_t *p, size_t len, command_t *cmd)
+{
+    size_t fixed = p[0] == COMMAND_BIN_PASS ? 7 : 3;
+    uint16_t arg;
+
+    if (len != fixed && len != fixed + 4) {
+        return false;
+    }
+    arg = (uint16_t)(p[1] | (p[2] << 8));
+    switch (p[0]) {
+        case COMMAND_BIN_OPEN:
+            cmd->op = COMMAND_OPEN;
+            break;
+        case COMMAND_BIN_CLOSE:
+            cmd->op = COMMAND_CLOSE;
+            break;
+        case COMMAND_BIN_STATUS:
+            cmd->op = COMMAND_STATUS;
+            break;
+        case COMMAND_BIN_PASS:
+            cmd->op = COMMAND_PASS;
+            cmd->credential = command_u32(p + 3);
+            break;
+        case COMMAND_BIN_HOLD:
+            if (arg == 0 || arg > COMMAND_HOLD_MAX_MS) {
+                return false;
+            }
+            cmd->op = COMMAND_HOLD;
+            cmd->hold_ms = arg;
+            break;
+        default:
+            return false;
+    }
+    if (cmd->op != COMMAND_HOLD && arg != 0) {
+        return false;
+    }
+    if (len == fixed + 4) {
+        cmd->has_request_id = true;
+        cmd->request_id = command_u32(p + fixed);
+    }
+    return true;
+}
+
+static bool command_parse_text(const char *p, size_t len, command_t *cmd)
+{
+    const char *at = memchr(p, '@', len);
+    uint32_t value;
+
+    if (at != NULL) {
+        size_t id_len = len - (size_t)(at - p) - 1;
+
+        if (!command_number(at + 1, id_len, UINT32_MAX, &value)) {
+            return false;
+        }
+        cmd->has_request_id = true;
+        cmd->request_id = value;
+        len = (size_t)(at - p);
+    }
+
+    if (command_token(p, len, "open", 4)) {
+        cmd->op = COMMAND_OPEN;
+    } else if (command_token(p, len, "close", 5)) {
+        cmd->op = COMMAND_CLOSE;
+    } else if (command_token(p, len, "status", 6)) {
+        cmd->op = COMMAND_STATUS;
+    } else if (len > 5 && memcmp(p, "hold ", 5) == 0) {
+        size_t digits = len - 5;
+
+        if (digits > 3 && memcmp(p + len - 3, " ms", 3) == 0) {
+            digits -= 3;
+        } else if (digits > 2 && memcmp(p + len - 2, "ms", 2) == 0) {
+            digits -= 2;
+        }
+        if (!command_number(p + 5, digits, COMMAND_HOLD_MAX_MS, &value) || value == 0) {
+            return false;
+        }
+        cmd->op = COMMAND_HOLD;
+        cmd->hold_ms = (uint16_t)value;
+    } else if (len > 5 && memcmp(p, "pass ", 5) == 0) {
+        if (!command_credential(p + 5, len - 5)) {
+            return false;
+        }
+        /* Hash in place so the token itself never leaves the MQTT buffer */
+        cmd->op = COMMAND_PASS;
+        cmd->credential = allowlist_hash(p + 5, len - 5);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool command_parse(const char *data, int len, command_t *out)
+{
+    command_t cmd = { 0 };
+    bool ok;
+
+    if (data == NULL || len <= 0 || len > COMMAND_MAX_LEN) {
+        return false;
+    }
+    if ((uint8_t)data[0] < 0x20) {
+        ok = command_parse_binary((const uint8_t *)data, (size_t)len, &cmd);
+    } else {
+        ok = command_parse_text(data, (size_t)len, &cmd);
+    }
+    if (ok) {
+        *out = cmd;
+    }
+    return ok;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Gate command payloads, parsed in place from the MQTT buffer (no copy, no allocation).
+ *
+ * Text:   "open" | "close" | "status" | "hold <ms>[ ms]" | "pass <plate or ticket>", optionally
+ *         followed by "@<request id>", e.g. "open@42", "hold 8000@7" or "pass AB12CDE@9"
+ * Binary: <op> <arg lo> <arg hi> [<credential>] [<request id>], op < 0x20 so it can never be
+ *         mistaken for text; arg is the hold time for COMMAND_BIN_HOLD, else 0. The credential
+ *         is the allowlist_hash() of the token and is present for COMMAND_BIN_PASS only. Both
+ *         trailing fields are 4 bytes little endian.
+ *
+ * Anything longer than COMMAND_MAX_LEN is rejected before its content is looked at, so a bad
+ * frame costs the same however large it is. */
+#define COMMAND_MAX_LEN 32
+#define COMMAND_HOLD_MAX_MS 60000       /* Longest hold a client may ask for */
+#define COMMAND_TOKEN_MAX_LEN 16        /* Longest plate/ticket string */
+
+#define COMMAND_BIN_OPEN 0x01
+#define COMMAND_BIN_CLOSE 0x02
+#define COMMAND_BIN_HOLD 0x03
+#define COMMAND_BIN_STATUS 0x04
+#define COMMAND_BIN_PASS 0x05
+
+typedef enum {
+    COMMAND_OPEN,
+    COMMAND_CLOSE,
+    COMMAND_HOLD,                   /* Open and keep open for hold_ms */
+    COMMAND_STATUS,
+    COMMAND_PASS,                   /* Open if the credential is on the local allow-list */
+} command_op_t;
+
+typedef struct {
+    command_op_t op;
+    uint16_t hold_ms;               /* COMMAND_HOLD only */
+    uint32_t credential;            /* COMMAND_PASS only: allowlist_hash() of the token */
+    bool has_request_id;
+    uint32_t request_id;
+} command_t;
+
+/* Function to parse one payload; returns false and leaves out untouched on a bad frame */
+bool command_parse(const char *data, int len, command_t *out);
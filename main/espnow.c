@@ -0,0 +1,246 @@
+#include "espnow.h"
+
+#if GATE_ESPNOW
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_now.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "nvs.h"
+#include "mbedtls/md.h"
+#include "motion.h"
+
+static const char *TAG = "ESPNOW";
+
+#define ESPNOW_COUNTER_LEN 4
+#define ESPNOW_MIN_FRAME (ESPNOW_COUNTER_LEN + 1 + ESPNOW_TAG_LEN)
+#define ESPNOW_BUSY_POLL_MS 100             /* Retry interval for the NVS write while a gate moves */
+
+/* Highest counter accepted from one peer. Keyed by MAC, so provisioning "peers" in
+ * another order cannot hand a reader someone else's counter; NVS blob "replay" is an
+ * array of these. */
+typedef struct {
+    uint8_t mac[6];
+    uint32_t counter;
+} espnow_counter_t;
+
+/* Counters mirrored in RTC memory: a software or watchdog reset inside the NVS save
+ * debounce must not reopen the window for the frames accepted just before it */
+#define ESPNOW_RTC_MAGIC 0x45534e57u    /* "ESNW" */
+typedef struct {
+    uint32_t magic;
+    espnow_counter_t peers[ESPNOW_MAX_PEERS];
+    uint32_t check[ESPNOW_MAX_PEERS];   /* ~counter, catches a store torn by the reset */
+} espnow_rtc_t;
+static RTC_NOINIT_ATTR espnow_rtc_t espnow_rtc;
+
+static espnow_peer_t peers[ESPNOW_MAX_PEERS];
+static size_t peer_count = 0;
+static espnow_counter_t counters[ESPNOW_MAX_PEERS]; /* Same order as peers */
+static mbedtls_md_context_t hmac[ESPNOW_MAX_PEERS]; /* Keyed once at init, reset per frame */
+static volatile uint32_t rejected = 0;
+
+static espnow_dispatch_t dispatch_fn;
+static TaskHandle_t save_task_handle;
+static StaticTask_t save_task_buffer;
+static StackType_t save_task_stack[ESPNOW_SAVE_TASK_STACK_SIZE];
+
+static inline uint32_t read_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/* Function to find a peer by MAC; returns peer_count if it is not paired */
+static size_t espnow_peer_index(const uint8_t *mac)
+{
+    size_t i;
+
+    for (i = 0; i < peer_count; i++) {
+        if (memcmp(peers[i].mac, mac, 6) == 0) {
+            break;
+        }
+    }
+    return i;
+}
+
+/* Save task: writes the replay counters a debounce after the first new frame, once no
+ * gate is moving. A task rather than a timer: the commit takes tens of ms and the close
+ * timers share the timer service task. */
+static void espnow_save_task(void *pvParameters)
+{
+    espnow_counter_t snapshot[ESPNOW_MAX_PEERS];
+    nvs_handle_t nvs;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        vTaskDelay(pdMS_TO_TICKS(ESPNOW_COUNTER_SAVE_MS));
+        while (motion_busy() != 0) {
+            vTaskDelay(pdMS_TO_TICKS(ESPNOW_BUSY_POLL_MS));
+        }
+        /* Frames from here on notify again; the ones before are in the snapshot */
+        ulTaskNotifyTake(pdTRUE, 0);
+        memcpy(snapshot, counters, peer_count * sizeof(counters[0]));
+
+        if (nvs_open(ESPNOW_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+            nvs_set_blob(nvs, "replay", snapshot, peer_count * sizeof(snapshot[0]));
+            nvs_commit(nvs);
+            nvs_close(nvs);
+        }
+    }
+}
+
+/* Function to check a frame's tag in constant time; hmac[i] is only used from here */
+static bool espnow_verify(size_t i, const uint8_t *mac, const uint8_t *data, size_t len)
+{
+    uint8_t digest[32];
+    uint8_t diff = 0;
+
+    if (mbedtls_md_hmac_reset(&hmac[i]) != 0 ||
+        mbedtls_md_hmac_update(&hmac[i], mac, 6) != 0 ||
+        mbedtls_md_hmac_update(&hmac[i], data, len - ESPNOW_TAG_LEN) != 0 ||
+        mbedtls_md_hmac_finish(&hmac[i], digest) != 0) {
+        return false;
+    }
+    for (size_t j = 0; j < ESPNOW_TAG_LEN; j++) {
+        diff |= digest[j] ^ data[len - ESPNOW_TAG_LEN + j];
+    }
+    return diff == 0;
+}
+
+/* Receive callback, on the Wi-Fi task: verify, check the counter and dispatch */
+static void espnow_recv(const esp_now_recv_info_t *info, const uint8_t *data, int len)
+{
+    int64_t rx_us = esp_timer_get_time();
+    command_t cmd;
+    size_t i = espnow_peer_index(info->src_addr);
+
+    if (i == peer_count || len < ESPNOW_MIN_FRAME || !espnow_verify(i, info->src_addr, data, (size_t)len)) {
+        rejected++;
+        return;
+    }
+
+    uint32_t counter = read_u32(data);
+    if (counter <= counters[i].counter ||
+        !command_parse((const char *)data + ESPNOW_COUNTER_LEN, len - ESPNOW_COUNTER_LEN - ESPNOW_TAG_LEN, &cmd) ||
+        (cmd.op != COMMAND_OPEN && cmd.op != COMMAND_PASS)) {
+        rejected++;
+        return;
+    }
+    counters[i].counter = counter;
+    /* Counter before check: a reset between the two leaves the entry invalid, not wrong */
+    espnow_rtc.peers[i].counter = counter;
+    espnow_rtc.check[i] = ~counter;
+    xTaskNotifyGive(save_task_handle);
+
+    dispatch_fn(peers[i].gates, &cmd, rx_us);
+}
+
+/* Function to load the replay counters of the paired peers from NVS, then raise them to
+ * what RTC memory kept over a software or watchdog reset */
+static void espnow_load_counters(nvs_handle_t nvs)
+{
+    espnow_counter_t saved[ESPNOW_MAX_PEERS];
+    size_t len = sizeof(saved);
+
+    memset(counters, 0, sizeof(counters));
+    for (size_t i = 0; i < peer_count; i++) {
+        memcpy(counters[i].mac, peers[i].mac, 6);
+    }
+    if (nvs_get_blob(nvs, "replay", saved, &len) == ESP_OK && len % sizeof(saved[0]) == 0) {
+        for (size_t n = 0; n < len / sizeof(saved[0]); n++) {
+            size_t i = espnow_peer_index(saved[n].mac);
+            if (i < peer_count) {
+                counters[i].counter = saved[n].counter;
+            }
+        }
+    } else {
+        /* Older firmware kept u32 counters in "peers" order; nothing better to go on */
+        uint32_t legacy[ESPNOW_MAX_PEERS];
+
+        len = peer_count * sizeof(legacy[0]);
+        if (nvs_get_blob(nvs, "counters", legacy, &len) == ESP_OK && len == peer_count * sizeof(legacy[0])) {
+            for (size_t i = 0; i < peer_count; i++) {
+                counters[i].counter = legacy[i];
+            }
+        }
+    }
+
+    switch (esp_reset_reason()) {
+        case ESP_RST_SW:
+        case ESP_RST_PANIC:
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:
+            if (espnow_rtc.magic != ESPNOW_RTC_MAGIC) {
+                break;
+            }
+            for (size_t n = 0; n < ESPNOW_MAX_PEERS; n++) {
+                size_t i = espnow_peer_index(espnow_rtc.peers[n].mac);
+                if (i < peer_count && espnow_rtc.check[n] == ~espnow_rtc.peers[n].counter &&
+                    espnow_rtc.peers[n].counter > counters[i].counter) {
+                    counters[i].counter = espnow_rtc.peers[n].counter;
+                }
+            }
+            break;
+        default:
+            break;                          /* RTC memory does not survive, or cannot be trusted */
+    }
+
+    /* Mirror in the new peer order, so the receive path updates entry i in place */
+    memset(&espnow_rtc, 0, sizeof(espnow_rtc));
+    for (size_t i = 0; i < peer_count; i++) {
+        espnow_rtc.peers[i] = counters[i];
+        espnow_rtc.check[i] = ~counters[i].counter;
+    }
+    espnow_rtc.magic = ESPNOW_RTC_MAGIC;
+}
+
+void espnow_init(espnow_dispatch_t dispatch)
+{
+    const mbedtls_md_info_t *sha256 = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+    nvs_handle_t nvs;
+    size_t len = sizeof(peers);
+
+    dispatch_fn = dispatch;
+    if (nvs_open(ESPNOW_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        ESP_LOGI(TAG, "[INIT] No paired readers, ESP-NOW stays off.");
+        return;
+    }
+    if (nvs_get_blob(nvs, "peers", peers, &len) == ESP_OK) {
+        peer_count = len / sizeof(peers[0]);
+        espnow_load_counters(nvs);
+    }
+    nvs_close(nvs);
+    if (peer_count == 0) {
+        ESP_LOGI(TAG, "[INIT] No paired readers, ESP-NOW stays off.");
+        return;
+    }
+
+    /* The HMAC contexts allocate here, once, so the receive path never touches the heap */
+    for (size_t i = 0; i < peer_count; i++) {
+        mbedtls_md_init(&hmac[i]);
+        if (mbedtls_md_setup(&hmac[i], sha256, 1) != 0 ||
+            mbedtls_md_hmac_starts(&hmac[i], peers[i].key, ESPNOW_KEY_LEN) != 0) {
+            ESP_LOGE(TAG, "[ERROR] Could not key HMAC for reader %u, ESP-NOW stays off.", (unsigned)i);
+            peer_count = 0;
+            return;
+        }
+    }
+
+    save_task_handle = xTaskCreateStatic(espnow_save_task, "espnow_save", ESPNOW_SAVE_TASK_STACK_SIZE, NULL,
+                                         ESPNOW_SAVE_TASK_PRIORITY, save_task_stack, &save_task_buffer);
+    ESP_ERROR_CHECK(esp_now_init());
+    ESP_ERROR_CHECK(esp_now_register_recv_cb(espnow_recv));
+    ESP_LOGI(TAG, "[INIT] ESP-NOW receiving from %u paired readers.", (unsigned)peer_count);
+}
+
+uint32_t espnow_rejected(void)
+{
+    return rejected;
+}
+
+#endif
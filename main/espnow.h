@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "gate.h"
+#include "command.h"
+#include "sched.h"
+
+/* ESP-NOW fast path: a paired reader a few metres from the gate sends its open straight
+ * to us over ESP-NOW instead of through the broker. Frames go to the same dispatch path
+ * as MQTT commands, and the resulting state events still reach the broker, so MQTT stays
+ * the audit channel.
+ *
+ * Frame: <counter u32 LE> <command> <tag>, where command is a command_parse() payload
+ * (open or pass only, text or binary) and tag is the first ESPNOW_TAG_LEN bytes of
+ * HMAC-SHA256(peer key, sender MAC | counter | command). The counter must grow with every
+ * frame from a peer; the highest one seen is kept per MAC in NVS (blob "replay"), and in
+ * RTC memory over software and watchdog resets, so a captured frame cannot be replayed
+ * after a reboot. Each peer is bound to the gates it may open.
+ *
+ * Peers are provisioned into NVS namespace ESPNOW_NVS_NAMESPACE, blob "peers", as an
+ * array of espnow_peer_t. The reader must be on the AP's channel; with GATE_POWER_SAVE
+ * a frame waits for the next modem wake-up. */
+#ifndef GATE_ESPNOW
+#define GATE_ESPNOW 0
+#endif
+
+#define ESPNOW_NVS_NAMESPACE "espnow"
+#define ESPNOW_MAX_PEERS 4
+#define ESPNOW_KEY_LEN 32
+#define ESPNOW_TAG_LEN 16
+#define ESPNOW_COUNTER_SAVE_MS 1000         /* Debounce for the replay counters in NVS */
+#define ESPNOW_SAVE_TASK_STACK_SIZE 2560
+#define ESPNOW_SAVE_TASK_PRIORITY SCHED_PRIORITY_JOURNAL   /* Flash work, below MQTT like the journal */
+
+typedef struct __attribute__((packed)) {
+    uint8_t mac[6];
+    gate_mask_t gates;                      /* Gates this reader may open */
+    uint8_t key[ESPNOW_KEY_LEN];
+} espnow_peer_t;
+
+/* Called from the Wi-Fi task: must not block */
+typedef void (*espnow_dispatch_t)(gate_mask_t mask, const command_t *cmd, int64_t rx_us);
+
+#if GATE_ESPNOW
+
+/* Function to load the peers and start receiving; after esp_wifi_start() and NVS */
+void espnow_init(espnow_dispatch_t dispatch);
+
+/* Function to get the frames dropped so far (unknown peer, bad tag, replay, bad command) */
+uint32_t espnow_rejected(void);
+
+#else
+
+#define espnow_init(dispatch) do { } while (0)
+#define espnow_rejected() 0u
+
+#endif
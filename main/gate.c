@@ -0,0 +1,748 @@
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/timers.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_pm.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "driver/mcpwm_prelude.h"
+#include "telemetry.h"
+#include "boot.h"
+#include "status.h"
+#include "memprof.h"
+#include "hil.h"
+#include "gate.h"
+#include "gate_config.h"
+#include "motion.h"
+#include "supervisor.h"
+
+static const char *TAG = "GATE";
+
+/* Gate table: adding a barrier is one entry here plus its id in gate.h. Angles and hold
+ * times here are the built-in defaults; the active ones come from gate_config.h. */
+static gate_t gates[GATE_COUNT] = {
+    [GATE_ID_ENTRY] = {
+        .name = "entry",
+        .label = "ENTRY",
+        .gpio_num = SERVO_ENTRY_GPIO,
+        .timer_id = 0,
+        .open_angle = GATE_OPEN_ANGLE1,
+        .closed_angle = GATE_CLOSED_ANGLE_1,
+        .hold_ms = GATE_OPEN_TIME_MS,
+    },
+    [GATE_ID_EXIT] = {
+        .name = "exit",
+        .label = "EXIT",
+        .gpio_num = SERVO_EXIT_GPIO,
+        .timer_id = 1,
+        .open_angle = GATE_OPEN_ANGLE2,
+        .closed_angle = GATE_CLOSED_ANGLE_2,
+        .hold_ms = GATE_OPEN_TIME_MS,
+    },
+};
+
+/* MCPWM handles: one timer and operator per timer_id, one comparator per gate */
+static mcpwm_timer_handle_t pwm_timers[GATE_MCPWM_TIMER_COUNT];
+static mcpwm_oper_handle_t pwm_operators[GATE_MCPWM_TIMER_COUNT];
+static mcpwm_cmpr_handle_t pwm_comparators[GATE_COUNT];
+static mcpwm_gen_handle_t pwm_generators[GATE_COUNT];
+static uint8_t pwm_timer_users[GATE_MCPWM_TIMER_COUNT];    /* Open gates per timer (power save) */
+static uint8_t pwm_release_pending[GATE_COUNT];             /* Closes not yet released (power save) */
+static TickType_t pwm_release_deadline;
+
+/* Cold per-gate data, kept out of the table walked on every command */
+static TimerHandle_t close_timers[GATE_COUNT];
+static StaticTimer_t close_timer_buffers[GATE_COUNT];
+static latency_ring_t gate_latency[GATE_COUNT];
+static uint32_t budget_overruns[GATE_COUNT];
+
+/* Open gates, kept in RTC memory over software and watchdog resets: a watchdog or supervisor
+ * reboot must not drop a barrier on a car that is passing under it */
+#define GATE_RTC_MAGIC 0x47415445u     /* "GATE" */
+typedef struct {
+    uint32_t magic;
+    gate_mask_t open;
+    gate_mask_t check;              /* ~open, catches stale or partially written state */
+} gate_rtc_state_t;
+static RTC_NOINIT_ATTR gate_rtc_state_t gate_rtc;
+
+static QueueHandle_t gate_queue;
+static StaticQueue_t gate_queue_buffer;
+static uint8_t gate_queue_storage[GATE_QUEUE_LENGTH * sizeof(gate_msg_t)];
+static StaticTask_t gate_task_buffer;
+static StackType_t gate_task_stack[GATE_TASK_STACK_SIZE];
+
+/* Accumulated effect of every command drained in one actuator pass */
+typedef struct {
+    gate_mask_t target;             /* Gates that should be open after this pass */
+    gate_mask_t extend;             /* Gates whose hold window restarts */
+    gate_mask_t timed;              /* Gates with MQTT timestamps below */
+    gate_mask_t expired;            /* Gates whose latest close is their hold window ending */
+    uint16_t hold_ms[GATE_COUNT];   /* Hold requested by the latest open, 0 for the default */
+    bool reload;                    /* Take over gate_config_active() after this pass */
+    gate_mask_t has_request_id;     /* Gates whose latest open/close carried a request ID */
+    uint32_t request_id[GATE_COUNT];
+    int64_t rx_us[GATE_COUNT];
+    int64_t dispatch_us[GATE_COUNT];
+} gate_batch_t;
+
+/* Opens the motion engine held back for a current slot: their latency and hold window
+ * are stamped when the first sweep step goes out, not when the command was applied */
+static gate_mask_t start_pending;
+static struct {
+    bool timed;
+    uint32_t hold_ms;
+    int64_t rx_us;
+    int64_t dispatch_us;
+} open_starts[GATE_COUNT];
+static gate_mask_t hold_unarmed;    /* Open gates whose close timer could not be armed yet */
+
+/* Function to convert an angle to compare ticks; only used when a configuration is applied */
+static uint16_t servo_angle_to_ticks(const gate_params_t *params, uint32_t angle)
+{
+    uint32_t pulse_width_us = (params->min_pulse_us + (((params->max_pulse_us - params->min_pulse_us) * angle) / SERVO_MAX_DEGREE));
+    return (uint16_t)((uint64_t)pulse_width_us * SERVO_TIMER_RESOLUTION_HZ / 1000000);
+}
+
+/* Function to copy a configuration into the gate table; returns the gates whose
+ * position for their current state moved */
+static gate_mask_t gate_config_take(const gate_config_t *config)
+{
+    gate_mask_t moved = 0;
+
+    for (int i = 0; i < GATE_COUNT; i++) {
+        const gate_params_t *p = &config->gates[i];
+        gate_t *gate = &gates[i];
+        uint16_t before = gate->is_open ? gate->open_ticks : gate->closed_ticks;
+
+        gate->open_ticks = servo_angle_to_ticks(p, p->open_angle);
+        gate->closed_ticks = servo_angle_to_ticks(p, p->closed_angle);
+        gate->hold_ms = p->hold_ms;
+        if ((gate->is_open ? gate->open_ticks : gate->closed_ticks) != before) {
+            moved |= GATE_MASK(i);
+        }
+    }
+    return moved;
+}
+
+/* Function to set a servo's pulse width directly, bypassing the motion profile; init only */
+static inline void set_servo_ticks(int id, uint32_t ticks)
+{
+    mcpwm_comparator_set_compare_value(pwm_comparators[id], ticks);
+}
+
+static gate_mask_t gate_open_mask(void)
+{
+    gate_mask_t mask = 0;
+
+    for (int i = 0; i < GATE_COUNT; i++) {
+        if (gates[i].is_open) {
+            mask |= GATE_MASK(i);
+        }
+    }
+    return mask;
+}
+
+/* Function to record which gates are open for the next boot */
+static void gate_rtc_save(gate_mask_t open)
+{
+    gate_rtc.open = open;
+    gate_rtc.check = (gate_mask_t)~open;
+    gate_rtc.magic = GATE_RTC_MAGIC;
+}
+
+/* Function to get the gates that were open before this reset: none after power-on, a
+ * brown-out or the reset pin, where closed is the only safe assumption */
+static gate_mask_t gate_rtc_restore(void)
+{
+    switch (esp_reset_reason()) {
+        case ESP_RST_SW:
+        case ESP_RST_PANIC:
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:
+            break;
+        default:
+            return 0;
+    }
+    if (gate_rtc.magic != GATE_RTC_MAGIC || gate_rtc.check != (gate_mask_t)~gate_rtc.open) {
+        return 0;
+    }
+    return gate_rtc.open & GATE_MASK_ALL;
+}
+
+/* Power save: the MCPWM driver holds a PM lock while a timer is enabled, so a timer
+ * is only enabled while one of its gates is open, sweeping or settling. Without power
+ * save the timers stay enabled from init and these are no-ops. */
+#if GATE_POWER_SAVE
+/* Function to force the outputs of every gate on a timer: 0 holds them low, -1 hands
+ * them back to the compare actions. A stopped timer halts at empty, where the action
+ * drives the line high, so a released servo would otherwise see DC instead of no pulses. */
+static void gate_pwm_force(uint8_t timer_id, int level)
+{
+    for (int i = 0; i < GATE_COUNT; i++) {
+        if (gates[i].timer_id == timer_id) {
+            ESP_ERROR_CHECK(mcpwm_generator_set_force_level(pwm_generators[i], level, true));
+        }
+    }
+}
+#endif
+
+static void gate_pwm_acquire(gate_mask_t mask)
+{
+#if GATE_POWER_SAVE
+    for (int i = 0; i < GATE_COUNT; i++) {
+        uint8_t timer_id = gates[i].timer_id;
+
+        if ((mask & GATE_MASK(i)) && pwm_timer_users[timer_id]++ == 0) {
+            ESP_ERROR_CHECK(mcpwm_timer_enable(pwm_timers[timer_id]));
+            ESP_ERROR_CHECK(mcpwm_timer_start_stop(pwm_timers[timer_id], MCPWM_TIMER_START_NO_STOP));
+            gate_pwm_force(timer_id, -1);
+        }
+    }
+#endif
+}
+
+/* Function to schedule the release of closing gates once their sweep has settled.
+ * The actuator keeps serving commands meanwhile; gate_pwm_release_due() does the work. */
+static void gate_pwm_release(gate_mask_t mask)
+{
+#if GATE_POWER_SAVE
+    if (mask == 0) {
+        return;
+    }
+    for (int i = 0; i < GATE_COUNT; i++) {
+        if (mask & GATE_MASK(i)) {
+            pwm_release_pending[i]++;
+        }
+    }
+    pwm_release_deadline = xTaskGetTickCount() + pdMS_TO_TICKS(GATE_SWEEP_MS + GATE_SERVO_SETTLE_MS);
+#endif
+}
+
+/* Function to get how long the actuator may block before a release falls due */
+static TickType_t gate_pwm_release_wait(void)
+{
+#if GATE_POWER_SAVE
+    for (int i = 0; i < GATE_COUNT; i++) {
+        if (pwm_release_pending[i] != 0) {
+            int32_t left = (int32_t)(pwm_release_deadline - xTaskGetTickCount());
+            return left > 0 ? (TickType_t)left : 0;
+        }
+    }
+#endif
+    return portMAX_DELAY;
+}
+
+/* Function to stop the timers of settled gates; a gate still sweeping (or waiting
+ * for a current slot) keeps its timer until the next settle period */
+static void gate_pwm_release_due(void)
+{
+#if GATE_POWER_SAVE
+    gate_mask_t busy = motion_busy();
+    bool deferred = false;
+
+    if ((int32_t)(pwm_release_deadline - xTaskGetTickCount()) > 0) {
+        return;
+    }
+    for (int i = 0; i < GATE_COUNT; i++) {
+        uint8_t timer_id = gates[i].timer_id;
+
+        if (pwm_release_pending[i] == 0) {
+            continue;
+        }
+        if (busy & GATE_MASK(i)) {
+            deferred = true;
+            continue;
+        }
+        for (; pwm_release_pending[i] != 0; pwm_release_pending[i]--) {
+            if (--pwm_timer_users[timer_id] == 0) {
+                gate_pwm_force(timer_id, 0);
+                ESP_ERROR_CHECK(mcpwm_timer_start_stop(pwm_timers[timer_id], MCPWM_TIMER_STOP_EMPTY));
+                ESP_ERROR_CHECK(mcpwm_timer_disable(pwm_timers[timer_id]));
+            }
+        }
+    }
+    if (deferred) {
+        pwm_release_deadline = xTaskGetTickCount() + pdMS_TO_TICKS(GATE_SERVO_SETTLE_MS);
+    }
+#endif
+}
+
+#if GATE_CLOSE_REPORTS
+/* Function to print the actuation latency budget of a gate as a PMLOG line */
+static void gate_budget_report(int id)
+{
+    latency_stats_t stats;
+
+    latency_get_stats(&gate_latency[id], LATENCY_STAGE_TOTAL, &stats);
+    printf("PMLOG,%lu,%s,%d,%lu,%lu,%lu,%lu\n",
+        (unsigned long)esp_log_timestamp(),
+        gates[id].name,
+        GATE_POWER_SAVE,
+        (unsigned long)stats.count,
+        (unsigned long)stats.p99_us,
+        (unsigned long)GATE_ACTUATE_BUDGET_US,
+        (unsigned long)budget_overruns[id]);
+}
+#endif
+
+/* Close timer callback: runs on the timer service task, so it only queues the expiry */
+static void gate_close_timer_cb(TimerHandle_t timer)
+{
+    gate_msg_t msg = {
+        .cmd = GATE_CMD_HOLD_EXPIRED,
+        .mask = GATE_MASK((uintptr_t)pvTimerGetTimerID(timer)),
+    };
+
+    if (xQueueSend(gate_queue, &msg, 0) != pdTRUE) {
+        /* Queue is full of pending commands; try again after another hold period */
+        xTimerReset(timer, 0);
+    }
+}
+
+/* Function to remember the request ID of the latest client command per gate */
+static void gate_batch_request_id(gate_batch_t *batch, const gate_msg_t *msg)
+{
+    for (int i = 0; i < GATE_COUNT; i++) {
+        if (msg->mask & GATE_MASK(i)) {
+            batch->has_request_id = msg->has_request_id ? batch->has_request_id | GATE_MASK(i)
+                                                        : batch->has_request_id & ~GATE_MASK(i);
+            batch->request_id[i] = msg->request_id;
+        }
+    }
+}
+
+/* Function to fold one command into the batch */
+static void gate_batch_add(gate_batch_t *batch, const gate_msg_t *msg, TickType_t now)
+{
+    switch (msg->cmd) {
+        case GATE_CMD_OPEN:
+            batch->target |= msg->mask;
+            batch->extend |= msg->mask;
+            batch->expired &= ~msg->mask;
+            gate_batch_request_id(batch, msg);
+            for (int i = 0; i < GATE_COUNT; i++) {
+                if (msg->mask & GATE_MASK(i)) {
+                    batch->hold_ms[i] = msg->hold_ms;
+                }
+            }
+            if (msg->rx_us != 0) {
+                for (int i = 0; i < GATE_COUNT; i++) {
+                    if ((msg->mask & GATE_MASK(i)) && !(batch->timed & GATE_MASK(i))) {
+                        batch->rx_us[i] = msg->rx_us;
+                        batch->dispatch_us[i] = msg->dispatch_us;
+                        batch->timed |= GATE_MASK(i);
+                    }
+                }
+            }
+            break;
+
+        case GATE_CMD_CLOSE:
+            batch->target &= ~msg->mask;
+            batch->extend &= ~msg->mask;
+            batch->expired &= ~msg->mask;
+            gate_batch_request_id(batch, msg);
+            break;
+
+        case GATE_CMD_RELOAD:
+            batch->reload = true;
+            break;
+
+        case GATE_CMD_HOLD_EXPIRED:
+            for (int i = 0; i < GATE_COUNT; i++) {
+                /* An expiry queued behind a later open belongs to a window that was extended,
+                 * and one for a gate still waiting to sweep open to the window before */
+                if (!(msg->mask & GATE_MASK(i)) || (batch->extend & GATE_MASK(i)) ||
+                    (start_pending & GATE_MASK(i)) || (int32_t)(gates[i].close_deadline - now) > 0) {
+                    continue;
+                }
+                batch->target &= ~GATE_MASK(i);
+                batch->expired |= GATE_MASK(i);
+            }
+            break;
+    }
+}
+
+/* Function to arm the close timer for the rest of the hold window. The timer command queue
+ * can be full under load; an unarmed gate would stay open for good, so the actuator then
+ * retries every poll period until the command goes through. */
+static void gate_hold_arm(int i)
+{
+    int32_t left = (int32_t)(gates[i].close_deadline - xTaskGetTickCount());
+
+    if (xTimerChangePeriod(close_timers[i], left > 0 ? (TickType_t)left : 1, 0) == pdPASS) {
+        hold_unarmed &= ~GATE_MASK(i);
+    } else if (!(hold_unarmed & GATE_MASK(i))) {
+        hold_unarmed |= GATE_MASK(i);
+        ESP_LOGW(TAG, "[WARN] Close timer of %s gate not armed, retrying.", gates[i].label);
+    }
+}
+
+/* Function to retry the close timers that could not be armed */
+static void gate_hold_arm_due(void)
+{
+    for (int i = 0; i < GATE_COUNT; i++) {
+        if ((hold_unarmed & GATE_MASK(i)) && gates[i].is_open) {
+            gate_hold_arm(i);
+        }
+    }
+}
+
+/* Function to (re)start the hold window of an open gate, counted from window_start_us */
+static void gate_hold_start(int i, int64_t window_start_us, uint32_t hold_ms)
+{
+    TickType_t hold = pdMS_TO_TICKS(hold_ms);
+    TickType_t late = pdMS_TO_TICKS((esp_timer_get_time() - window_start_us) / 1000);
+
+    /* A held-back open is stamped up to a poll period after its sweep started */
+    hold = late < hold ? hold - late : 1;
+    gates[i].close_deadline = xTaskGetTickCount() + hold;
+    gate_hold_arm(i);
+    hil_expect_hold(i, window_start_us, hold_ms);
+}
+
+/* Function to stamp an open once its first sweep step is out: the actuation latency,
+ * and the hold window, which counts from there */
+static void gate_open_started(int i, int64_t start_us)
+{
+    if (open_starts[i].timed) {
+        latency_record(&gate_latency[i], open_starts[i].rx_us, open_starts[i].dispatch_us, start_us);
+        if (start_us - open_starts[i].rx_us > GATE_ACTUATE_BUDGET_US) {
+            budget_overruns[i]++;
+        }
+    }
+    gate_hold_start(i, start_us, open_starts[i].hold_ms);
+}
+
+/* Function to stamp the held-back opens the motion engine has started since the last call */
+static void gate_start_pending_due(void)
+{
+    for (int i = 0; i < GATE_COUNT; i++) {
+        int64_t start_us;
+
+        if ((start_pending & GATE_MASK(i)) && (start_us = motion_started_us(i)) != 0) {
+            start_pending &= ~GATE_MASK(i);
+            gate_open_started(i, start_us);
+        }
+    }
+}
+
+/* Function to get how long the actuator may block: until a release falls due, and no
+ * longer than a poll period while an open waits for its current slot or close timer */
+static TickType_t gate_wait(void)
+{
+    TickType_t wait = gate_pwm_release_wait();
+
+    if ((start_pending | hold_unarmed) != 0 && wait > pdMS_TO_TICKS(GATE_START_POLL_MS)) {
+        wait = pdMS_TO_TICKS(GATE_START_POLL_MS);
+    }
+    return wait;
+}
+
+/* Function to apply a batch: all sweeps started first, back to back, then bookkeeping */
+static void gate_batch_apply(gate_batch_t *batch, gate_mask_t open_now)
+{
+    gate_mask_t opening = batch->target & ~open_now;
+    gate_mask_t closing = open_now & ~batch->target;
+    gate_mask_t moving = opening | closing;
+    int64_t start_us[GATE_COUNT];
+
+    gate_pwm_acquire(opening);
+
+    /* The motion engine stamps each gate's first sweep step as it writes it, before any
+     * logging here; a gate the current limit holds back is stamped when it starts */
+    start_pending &= ~moving;
+    hold_unarmed &= ~closing;
+    for (int i = 0; i < GATE_COUNT; i++) {
+        if (moving & GATE_MASK(i)) {
+            if (opening & GATE_MASK(i)) {
+                hil_expect_open(i, (batch->timed & GATE_MASK(i)) ? batch->rx_us[i] : esp_timer_get_time());
+            } else {
+                hil_expect_close(i, (batch->expired & GATE_MASK(i)) != 0);
+            }
+            start_us[i] = motion_start(i, (opening & GATE_MASK(i)) ? gates[i].open_ticks : gates[i].closed_ticks);
+            gates[i].is_open = (opening & GATE_MASK(i)) != 0;
+        }
+    }
+    if (moving != 0) {
+        gate_rtc_save(batch->target);
+    }
+
+    for (int i = 0; i < GATE_COUNT; i++) {
+        gate_mask_t bit = GATE_MASK(i);
+        uint32_t hold_ms = batch->hold_ms[i] != 0 ? batch->hold_ms[i] : gates[i].hold_ms;
+
+        if (opening & bit) {
+            open_starts[i].timed = (batch->timed & bit) != 0;
+            open_starts[i].hold_ms = hold_ms;
+            open_starts[i].rx_us = batch->rx_us[i];
+            open_starts[i].dispatch_us = batch->dispatch_us[i];
+            if (start_us[i] != 0) {
+                gate_open_started(i, start_us[i]);
+            } else {
+                start_pending |= bit;
+            }
+        } else if ((batch->extend & bit) && gates[i].is_open) {
+            /* Restart the hold window so the gate stays open for the last car; one still
+             * waiting for its sweep takes the new hold when it starts */
+            if (start_pending & bit) {
+                open_starts[i].hold_ms = hold_ms;
+            } else {
+                gate_hold_start(i, esp_timer_get_time(), hold_ms);
+            }
+        } else if (closing & bit) {
+            /* If the stop cannot be queued, the late expiry finds the gate closed already */
+            xTimerStop(close_timers[i], 0);
+        }
+
+        if (opening & bit) {
+            telemetry_record(TELEMETRY_EVT_BEFORE_GATE_OPEN, i);
+            boot_mark(BOOT_PHASE_FIRST_OPEN);
+            status_post(i, STATUS_EVT_OPEN, (batch->has_request_id & bit) != 0, batch->request_id[i]);
+            memprof_begin(gates[i].name);   /* One region per open-to-close cycle */
+            ESP_LOGI(TAG, "[ACTION] Opening %s gate...", gates[i].label);
+        } else if (closing & bit) {
+            status_post(i, STATUS_EVT_CLOSED, (batch->has_request_id & bit) != 0, batch->request_id[i]);
+            ESP_LOGI(TAG, "[ACTION] Closing %s gate...", gates[i].label);
+        } else if ((batch->extend & bit) && gates[i].is_open) {
+            ESP_LOGI(TAG, "[ACTION] Extending %s gate open time...", gates[i].label);
+        }
+    }
+
+    gate_pwm_release(closing);
+
+    for (int i = 0; i < GATE_COUNT; i++) {
+        if (closing & GATE_MASK(i)) {
+            telemetry_record(TELEMETRY_EVT_AFTER_GATE_CLOSE, i);
+            memprof_end(gates[i].name);
+#if GATE_CLOSE_REPORTS
+            latency_report(&gate_latency[i], gates[i].name);
+            gate_budget_report(i);
+#endif
+        }
+    }
+}
+
+/* Function to apply a new configuration after a batch: gates resting at a position that
+ * changed sweep there through the motion profile, the new hold time counts from the next open */
+static void gate_reload_apply(void)
+{
+    const gate_config_t *config = gate_config_active();
+    gate_mask_t moved = gate_config_take(config);
+    gate_mask_t closed = moved & ~gate_open_mask();
+
+    gate_pwm_acquire(closed);
+    for (int i = 0; i < GATE_COUNT; i++) {
+        if (moved & GATE_MASK(i)) {
+            hil_expect_close(i, false);
+            motion_start(i, gates[i].is_open ? gates[i].open_ticks : gates[i].closed_ticks);
+        }
+    }
+    gate_pwm_release(closed);
+    gate_config_applied(config->seq);
+    ESP_LOGI(TAG, "[CONFIG] Configuration revision %lu applied.", (unsigned long)config->seq);
+}
+
+/* Gate actuator task: drains every pending command, then moves all affected gates together */
+static void gate_task(void *pvParameters)
+{
+    gate_msg_t msg;
+
+    /* gate_init() left every timer running to drive the servos to their restored
+     * positions; open gates keep theirs as after any open */
+    gate_pwm_release(GATE_MASK_ALL & ~gate_open_mask());
+    supervisor_watch();
+
+    for (;;) {
+        if (xQueueReceive(gate_queue, &msg, SUPERVISOR_WAIT(gate_wait())) != pdTRUE) {
+            gate_start_pending_due();
+            gate_hold_arm_due();
+            gate_pwm_release_due();
+            supervisor_beat();
+            continue;
+        }
+
+        gate_mask_t open_now = gate_open_mask();
+        gate_batch_t batch = {
+            .target = open_now,
+        };
+        TickType_t now = xTaskGetTickCount();
+
+        do {
+            gate_batch_add(&batch, &msg, now);
+        } while (xQueueReceive(gate_queue, &msg, 0) == pdTRUE);
+
+        gate_batch_apply(&batch, open_now);
+        if (batch.reload) {
+            gate_reload_apply();
+        }
+        gate_start_pending_due();
+        gate_hold_arm_due();
+        gate_pwm_release_due();
+        supervisor_beat();
+    }
+}
+
+bool gate_send(const gate_msg_t *msg)
+{
+    return xQueueSend(gate_queue, msg, 0) == pdTRUE;
+}
+
+bool gate_reload(void)
+{
+    gate_msg_t msg = {
+        .cmd = GATE_CMD_RELOAD,
+    };
+
+    return xQueueSend(gate_queue, &msg, 0) == pdTRUE;
+}
+
+void gate_default_params(uint8_t id, gate_params_t *params)
+{
+    params->min_pulse_us = SERVO_MIN_PULSEWIDTH;
+    params->max_pulse_us = SERVO_MAX_PULSEWIDTH;
+    params->open_angle = gates[id].open_angle;
+    params->closed_angle = gates[id].closed_angle;
+    params->hold_ms = GATE_OPEN_TIME_MS;
+}
+
+bool gate_is_open(uint8_t id)
+{
+    return id < GATE_COUNT && gates[id].is_open;
+}
+
+const latency_ring_t *gate_latency_ring(uint8_t id)
+{
+    return &gate_latency[id];
+}
+
+uint32_t gate_queue_depth(void)
+{
+    return uxQueueMessagesWaiting(gate_queue);
+}
+
+const char *gate_name(uint8_t id)
+{
+    return id < GATE_COUNT ? gates[id].name : "unknown";
+}
+
+const char *gate_label(uint8_t id)
+{
+    return id < GATE_COUNT ? gates[id].label : "UNKNOWN";
+}
+
+/* Function to create the MCPWM timer and operator behind a timer_id; its period
+ * interrupt is attached to the motion engine once the gates are known */
+static void gate_pwm_timer_init(uint8_t timer_id)
+{
+    mcpwm_timer_config_t timer_config = {
+        .group_id = 0,
+        .clk_src = MCPWM_TIMER_CLK_SRC_DEFAULT,
+        .resolution_hz = SERVO_TIMER_RESOLUTION_HZ,
+        .period_ticks = SERVO_PERIOD_TICKS,
+        .count_mode = MCPWM_TIMER_COUNT_MODE_UP,
+    };
+    mcpwm_operator_config_t operator_config = {
+        .group_id = 0,
+    };
+
+    ESP_ERROR_CHECK(mcpwm_new_timer(&timer_config, &pwm_timers[timer_id]));
+    ESP_ERROR_CHECK(mcpwm_new_operator(&operator_config, &pwm_operators[timer_id]));
+    ESP_ERROR_CHECK(mcpwm_operator_connect_timer(pwm_operators[timer_id], pwm_timers[timer_id]));
+}
+
+/* Function to create a gate's comparator and generator: high on timer empty, low on compare.
+ * An operator has two of each, so a third gate on the same timer_id fails here. */
+static void gate_pwm_output_init(int id)
+{
+    gate_t *gate = &gates[id];
+    mcpwm_oper_handle_t oper = pwm_operators[gate->timer_id];
+    mcpwm_comparator_config_t comparator_config = {
+        .flags.update_cmp_on_tez = true,    /* Never cut a pulse short mid-period */
+    };
+    mcpwm_generator_config_t generator_config = {
+        .gen_gpio_num = gate->gpio_num,
+    };
+
+    ESP_ERROR_CHECK(mcpwm_new_comparator(oper, &comparator_config, &pwm_comparators[id]));
+    ESP_ERROR_CHECK(mcpwm_new_generator(oper, &generator_config, &pwm_generators[id]));
+    set_servo_ticks(id, gate->closed_ticks);
+    ESP_ERROR_CHECK(mcpwm_generator_set_action_on_timer_event(pwm_generators[id],
+        MCPWM_GEN_TIMER_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, MCPWM_TIMER_EVENT_EMPTY, MCPWM_GEN_ACTION_HIGH)));
+    ESP_ERROR_CHECK(mcpwm_generator_set_action_on_compare_event(pwm_generators[id],
+        MCPWM_GEN_COMPARE_EVENT_ACTION(MCPWM_TIMER_DIRECTION_UP, pwm_comparators[id], MCPWM_GEN_ACTION_LOW)));
+}
+
+void gate_init(void)
+{
+    uint16_t initial_ticks[GATE_COUNT];
+    gate_mask_t restored = gate_rtc_restore();
+
+    ESP_LOGI(TAG, "[INIT] Initializing %d gate servos...", GATE_COUNT);
+
+    /* Nothing has moved yet, whatever the gates restore to */
+    gate_config_take(gate_config_active());
+
+    for (int i = 0; i < GATE_COUNT; i++) {
+        gate_t *gate = &gates[i];
+
+        if (pwm_timers[gate->timer_id] == NULL) {
+            gate_pwm_timer_init(gate->timer_id);
+        }
+
+        gate_pwm_output_init(i);
+        gate->is_open = (restored & GATE_MASK(i)) != 0;
+        initial_ticks[i] = gate->is_open ? gate->open_ticks : gate->closed_ticks;
+        set_servo_ticks(i, initial_ticks[i]);
+
+        close_timers[i] = xTimerCreateStatic(gate->name, pdMS_TO_TICKS(gate->hold_ms), pdFALSE,
+                                             (void *)(uintptr_t)i, gate_close_timer_cb,
+                                             &close_timer_buffers[i]);
+    }
+
+    /* Hook each timer's period interrupt up to the gates it drives, then start the
+     * timers so every servo is driven to its initial position */
+    motion_init(pwm_comparators, initial_ticks);
+    for (int t = 0; t < GATE_MCPWM_TIMER_COUNT; t++) {
+        if (pwm_timers[t] != NULL) {
+            gate_mask_t on_timer = 0;
+
+            for (int i = 0; i < GATE_COUNT; i++) {
+                if (gates[i].timer_id == t) {
+                    on_timer |= GATE_MASK(i);
+                }
+            }
+            motion_attach_timer(pwm_timers[t], on_timer);
+            ESP_ERROR_CHECK(mcpwm_timer_enable(pwm_timers[t]));
+            ESP_ERROR_CHECK(mcpwm_timer_start_stop(pwm_timers[t], MCPWM_TIMER_START_NO_STOP));
+        }
+    }
+#if GATE_POWER_SAVE
+    for (int i = 0; i < GATE_COUNT; i++) {
+        pwm_timer_users[gates[i].timer_id]++;
+    }
+#endif
+
+    /* One persistent actuator task serves the whole table */
+    gate_queue = xQueueCreateStatic(GATE_QUEUE_LENGTH, sizeof(gate_msg_t),
+                                    gate_queue_storage, &gate_queue_buffer);
+    xTaskCreateStatic(gate_task, "gate_actuator", GATE_TASK_STACK_SIZE, NULL,
+                      GATE_TASK_PRIORITY, gate_task_stack, &gate_task_buffer);
+
+    /* A restored gate gets a fresh hold window, then closes as usual */
+    gate_rtc_save(restored);
+    for (int i = 0; i < GATE_COUNT; i++) {
+        if (restored & GATE_MASK(i)) {
+            gates[i].close_deadline = xTaskGetTickCount() + pdMS_TO_TICKS(gates[i].hold_ms);
+            /* Boot may block for the timer command queue, the actuator never does */
+            xTimerChangePeriod(close_timers[i], pdMS_TO_TICKS(gates[i].hold_ms), portMAX_DELAY);
+            status_post(i, STATUS_EVT_OPEN, false, 0);
+            memprof_begin(gates[i].name);
+            ESP_LOGW(TAG, "[INIT] %s gate was open before the reset, kept open.", gates[i].label);
+        }
+    }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "latency.h"
+#include "sched.h"
+
+/* Power management: DFS plus automatic light sleep and Wi-Fi modem sleep while idle.
+ * Needs the sdkconfig.powersave fragment (CONFIG_PM_ENABLE, tickless idle). */
+#ifndef GATE_POWER_SAVE
+#define GATE_POWER_SAVE 0
+#endif
+#define GATE_ACTUATE_BUDGET_US 20000    /* MQTT receive to PWM update budget reported in PMLOG */
+
+/* Set to 0 to drop the LATLOG and PMLOG rows the actuator prints after every close
+ * (release builds); the latency rings are still kept for the metrics task */
+#ifndef GATE_CLOSE_REPORTS
+#define GATE_CLOSE_REPORTS 1
+#endif
+#define GATE_SERVO_SETTLE_MS 600        /* PWM kept running after a close so the arm reaches its stop */
+#define GATE_START_POLL_MS 20           /* Check for opens the current limit held back, one PWM period */
+
+/* Servo configuration; the pulse widths, angles and open time below are the built-in
+ * defaults, a gate_config.h blob in NVS overrides them per gate */
+#define SERVO_MIN_PULSEWIDTH 600     /* Minimum pulse width in microseconds */
+#define SERVO_MAX_PULSEWIDTH 2400    /* Maximum pulse width in microseconds */
+#define SERVO_MAX_DEGREE 180         /* Maximum angle in degrees */
+#define SERVO_PWM_FREQUENCY_HZ 50    /* 20 ms servo period */
+#define SERVO_TIMER_RESOLUTION_HZ 1000000    /* 1 tick = 1 us */
+#define SERVO_PERIOD_TICKS (SERVO_TIMER_RESOLUTION_HZ / SERVO_PWM_FREQUENCY_HZ)
+#define SERVO_ENTRY_GPIO 5           /* GPIO for entry gate servo */
+#define SERVO_EXIT_GPIO 18           /* GPIO for exit gate servo */
+
+/* Gate configuration */
+#define GATE_OPEN_ANGLE1 90             /* Angle when entry gate is open */
+#define GATE_CLOSED_ANGLE_1 180         /* Angle for entry servo motor when gate is open */
+#define GATE_OPEN_ANGLE2 90            /* Angle when exit gate is open */
+#define GATE_CLOSED_ANGLE_2 180          /* Angle for exit servo motor when gate is closed */
+#define GATE_OPEN_TIME_MS 5000          /* Time to keep gate open in milliseconds */
+
+/* One C6 drives up to three MCPWM timers/operators with two generators each */
+#define GATE_MCPWM_TIMER_COUNT 3
+#define GATE_MAX_COUNT (GATE_MCPWM_TIMER_COUNT * 2)
+
+/* Gate actuator task configuration */
+#define GATE_TASK_STACK_SIZE 3072       /* Stack size of the gate actuator task in bytes */
+#define GATE_TASK_PRIORITY SCHED_PRIORITY_GATE_ACTUATOR     /* See sched.h */
+#define GATE_QUEUE_LENGTH 16            /* Commands that can be pending for all gates */
+
+/* Gate ids index the gate table in gate.c */
+typedef enum {
+    GATE_ID_ENTRY,
+    GATE_ID_EXIT,
+    GATE_COUNT,
+} gate_id_t;
+
+_Static_assert(GATE_COUNT <= GATE_MAX_COUNT, "More gates than MCPWM outputs");
+
+/* Set of gates that move together, one bit per gate id */
+typedef uint8_t gate_mask_t;
+#define GATE_MASK(id) ((gate_mask_t)(1u << (id)))
+#define GATE_MASK_ALL ((gate_mask_t)((1u << GATE_COUNT) - 1))
+
+typedef enum {
+    GATE_CMD_OPEN,
+    GATE_CMD_CLOSE,
+    GATE_CMD_HOLD_EXPIRED,          /* Posted by the close timers, not by clients */
+    GATE_CMD_RELOAD,                /* Take over gate_config_active(), posted by gate_reload() */
+} gate_cmd_t;
+
+/* Tunable parameters of one gate, as stored in the gate_config.h blob */
+typedef struct __attribute__((packed)) {
+    uint16_t min_pulse_us;          /* Pulse width at 0 degrees */
+    uint16_t max_pulse_us;          /* Pulse width at SERVO_MAX_DEGREE */
+    uint8_t open_angle;
+    uint8_t closed_angle;
+    uint16_t hold_ms;               /* Time to keep the gate open after the last open */
+} gate_params_t;
+
+/* Command queued to the gate actuator, carrying the timestamps used for LATLOG */
+typedef struct {
+    gate_cmd_t cmd;
+    gate_mask_t mask;
+    uint16_t hold_ms;               /* GATE_CMD_OPEN: hold time, 0 for the gate's default */
+    bool has_request_id;            /* Client request ID echoed in the state events */
+    uint32_t request_id;
+    int64_t rx_us;                  /* esp_timer time at MQTT_EVENT_DATA, 0 if not from MQTT */
+    int64_t dispatch_us;            /* esp_timer time at the gate control task */
+} gate_msg_t;
+
+/* Gate descriptor and its hot state in one compact entry; static buffers live elsewhere */
+typedef struct {
+    const char *name;               /* Lower-case name used in MEMLOG/LATLOG lines */
+    const char *label;              /* Upper-case name used in log messages */
+    uint8_t gpio_num;
+    uint8_t timer_id;               /* MCPWM timer and operator; at most two gates share one */
+    uint8_t open_angle;             /* Built-in defaults, see gate_default_params() */
+    uint8_t closed_angle;
+    uint16_t open_ticks;            /* Compare values precomputed from gate_config_active() */
+    uint16_t closed_ticks;
+    uint16_t hold_ms;               /* Time to keep the gate open after the last open */
+    bool is_open;
+    TickType_t close_deadline;      /* Tick at which the current hold window ends */
+} gate_t;
+
+/* Function to configure MCPWM for every gate, close them and start the actuator */
+void gate_init(void);
+
+/* Function to queue a command without blocking; returns false if the queue is full */
+bool gate_send(const gate_msg_t *msg);
+
+/* Function to get a gate's built-in parameters from the gate table */
+void gate_default_params(uint8_t id, gate_params_t *params);
+
+/* Function to have the actuator take over gate_config_active() between two batches; a
+ * gate resting at an old position sweeps to the new one. False if the queue is full. */
+bool gate_reload(void);
+
+/* Function to tell whether a gate is open (or opening); a snapshot, no locking */
+bool gate_is_open(uint8_t id);
+
+/* Function to get a gate's latency ring for statistics; readable from any task */
+const latency_ring_t *gate_latency_ring(uint8_t id);
+
+/* Function to get the number of commands waiting for the actuator */
+uint32_t gate_queue_depth(void);
+
+/* Function to look up a gate's names by id */
+const char *gate_name(uint8_t id);
+const char *gate_label(uint8_t id);
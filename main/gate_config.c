@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "nvs.h"
+#include "gate_config.h"
+
+static const char *TAG = "GATE_CONFIG";
+
+static gate_config_t buffers[2];
+static uint8_t active = 0;                  /* Index into buffers, swapped atomically */
+static volatile uint32_t applied_seq = 0;   /* Written by the actuator */
+
+/* Function to check a blob before it may become active */
+static bool gate_config_valid(const gate_config_t *config)
+{
+    if (config->version != GATE_CONFIG_VERSION || config->gate_count != GATE_COUNT) {
+        return false;
+    }
+    for (int i = 0; i < GATE_COUNT; i++) {
+        const gate_params_t *p = &config->gates[i];
+
+        if (p->min_pulse_us < GATE_CONFIG_PULSE_MIN_US || p->max_pulse_us > GATE_CONFIG_PULSE_MAX_US ||
+            p->min_pulse_us >= p->max_pulse_us || p->open_angle > SERVO_MAX_DEGREE ||
+            p->closed_angle > SERVO_MAX_DEGREE || p->hold_ms == 0 || p->hold_ms > GATE_CONFIG_HOLD_MAX_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Function to build the built-in configuration, with the hold times of older firmware */
+static void gate_config_defaults(gate_config_t *config, nvs_handle_t nvs, bool have_nvs)
+{
+    memset(config, 0, sizeof(*config));
+    config->version = GATE_CONFIG_VERSION;
+    config->gate_count = GATE_COUNT;
+    for (uint8_t i = 0; i < GATE_COUNT; i++) {
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        uint16_t hold_ms;
+
+        gate_default_params(i, &config->gates[i]);
+        snprintf(key, sizeof(key), "%s_hold", gate_name(i));
+        if (have_nvs && nvs_get_u16(nvs, key, &hold_ms) == ESP_OK && hold_ms != 0 &&
+            hold_ms <= GATE_CONFIG_HOLD_MAX_MS) {
+            config->gates[i].hold_ms = hold_ms;
+            ESP_LOGI(TAG, "[INIT] %s gate hold time from NVS: %u ms", gate_label(i), hold_ms);
+        }
+    }
+}
+
+void gate_config_load(void)
+{
+    gate_config_t *config = &buffers[0];
+    size_t len = sizeof(*config);
+    nvs_handle_t nvs = 0;
+    bool have_nvs;
+
+    /* A fresh device has no namespace yet */
+    have_nvs = nvs_open(GATE_CONFIG_NAMESPACE, NVS_READONLY, &nvs) == ESP_OK;
+    if (!have_nvs || nvs_get_blob(nvs, GATE_CONFIG_KEY, config, &len) != ESP_OK ||
+        len != sizeof(*config) || !gate_config_valid(config)) {
+        gate_config_defaults(config, nvs, have_nvs);
+    }
+    if (have_nvs) {
+        nvs_close(nvs);
+    }
+    active = 0;
+    applied_seq = config->seq;
+    ESP_LOGI(TAG, "[INIT] Gate configuration revision %lu.", (unsigned long)config->seq);
+}
+
+const gate_config_t *gate_config_active(void)
+{
+    return &buffers[__atomic_load_n(&active, __ATOMIC_ACQUIRE)];
+}
+
+gate_config_result_t gate_config_update(const uint8_t *data, size_t len)
+{
+    uint8_t current = __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+    gate_config_t *next = &buffers[current ^ 1];
+    nvs_handle_t nvs;
+
+    if (len != sizeof(gate_config_t)) {
+        return GATE_CONFIG_INVALID;
+    }
+    /* Until then the actuator may still read the other buffer */
+    if (applied_seq != buffers[current].seq) {
+        return GATE_CONFIG_BUSY;
+    }
+    memcpy(next, data, len);
+    if (!gate_config_valid(next)) {
+        return GATE_CONFIG_INVALID;
+    }
+    if (next->seq <= buffers[current].seq) {
+        return GATE_CONFIG_STALE;
+    }
+
+    __atomic_store_n(&active, current ^ 1, __ATOMIC_RELEASE);
+    if (!gate_reload()) {
+        __atomic_store_n(&active, current, __ATOMIC_RELEASE);
+        return GATE_CONFIG_BUSY;
+    }
+
+    /* Persisted after the swap: a failed write only costs the update at the next boot */
+    if (nvs_open(GATE_CONFIG_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        ESP_LOGW(TAG, "[WARN] Could not open NVS, configuration kept in RAM only.");
+        return GATE_CONFIG_APPLIED;
+    }
+    if (nvs_set_blob(nvs, GATE_CONFIG_KEY, next, sizeof(*next)) != ESP_OK || nvs_commit(nvs) != ESP_OK) {
+        ESP_LOGW(TAG, "[WARN] Could not persist gate configuration %lu.", (unsigned long)next->seq);
+    }
+    nvs_close(nvs);
+    return GATE_CONFIG_APPLIED;
+}
+
+void gate_config_applied(uint32_t seq)
+{
+    applied_seq = seq;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "gate.h"
+
+/* Runtime gate parameters: one versioned blob with the pulse widths, angles and hold time
+ * of every gate, loaded from NVS at boot and replaced over MQTT without a reflash.
+ *
+ * Two buffers: an update is validated into the inactive one, the active index is
+ * swapped, and the actuator takes the new values over between two batches (gate_reload),
+ * so the hot path only ever reads the plain gate table and never waits on NVS. The
+ * previous buffer is not reused before the actuator has applied the swap.
+ *
+ * Wire and NVS format: gate_config_t, little endian, on parking/gate/<client id>/config
+ * (retained, so a controller that was offline picks up the latest on connect). seq must
+ * grow with every revision; a replayed or older blob is ignored. The outcome is posted as
+ * a "config" state event whose request ID is the seq now in force.
+ *
+ * A device without a blob falls back to the gate table, plus the "<gate>_hold" keys that
+ * older firmware read from the same namespace. */
+#define GATE_CONFIG_NAMESPACE "gate_cfg"
+#define GATE_CONFIG_KEY "config"
+#define GATE_CONFIG_VERSION 1
+
+/* Accepted ranges */
+#define GATE_CONFIG_PULSE_MIN_US 400
+#define GATE_CONFIG_PULSE_MAX_US 2600
+#define GATE_CONFIG_HOLD_MAX_MS 60000
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;                        /* GATE_CONFIG_VERSION */
+    uint8_t gate_count;                     /* Must be GATE_COUNT */
+    uint16_t reserved;
+    uint32_t seq;                           /* Revision, 0 for the built-in defaults */
+    gate_params_t gates[GATE_COUNT];
+} gate_config_t;
+
+typedef enum {
+    GATE_CONFIG_APPLIED,
+    GATE_CONFIG_STALE,                      /* seq not newer than the active one */
+    GATE_CONFIG_INVALID,                    /* Wrong size, version or gate count, or out of range */
+    GATE_CONFIG_BUSY,                       /* Previous update not applied yet; send it again */
+} gate_config_result_t;
+
+/* Function to load the active configuration; call once before gate_init() */
+void gate_config_load(void);
+
+/* Function to get the configuration in force; the actuator reads it on GATE_CMD_RELOAD */
+const gate_config_t *gate_config_active(void);
+
+/* Function to validate, swap in and persist an update; MQTT task only */
+gate_config_result_t gate_config_update(const uint8_t *data, size_t len);
+
+/* Function called by the actuator once it has taken over the configuration with this seq */
+void gate_config_applied(uint32_t seq);
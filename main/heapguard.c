@@ -0,0 +1,106 @@
+#include "heapguard.h"
+
+#if GATE_HEAP_GUARD
+
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+
+typedef struct {
+    TaskHandle_t task;              /* NULL for allocations from ISRs or untracked tasks */
+    char name[configMAX_TASK_NAME_LEN];     /* Copied in the hook, the task may be gone by the report */
+    uint32_t count;
+    uint32_t bytes;
+} heapguard_site_t;
+
+static heapguard_site_t sites[HEAPGUARD_MAX_TASKS + 1];    /* Last slot is "other" */
+static uint32_t reported_count[HEAPGUARD_MAX_TASKS + 1];
+static volatile bool armed = false;
+static portMUX_TYPE heapguard_lock = portMUX_INITIALIZER_UNLOCKED;
+static StaticTask_t report_task_buffer;
+static StackType_t report_task_stack[HEAPGUARD_TASK_STACK_SIZE];
+
+/* Allocation hook called by the heap after every successful allocation. It must not
+ * allocate or log, so it only bumps counters. */
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    TaskHandle_t task;
+    heapguard_site_t *site;
+
+    if (!armed) {
+        return;
+    }
+#if GATE_HEAP_GUARD_ABORT
+    esp_system_abort("Heap allocation after READY");
+#endif
+    task = xPortInIsrContext() ? NULL : xTaskGetCurrentTaskHandle();
+
+    portENTER_CRITICAL_SAFE(&heapguard_lock);
+    site = &sites[HEAPGUARD_MAX_TASKS];
+    for (int i = 0; task != NULL && i < HEAPGUARD_MAX_TASKS; i++) {
+        if (sites[i].task == task || sites[i].task == NULL) {
+            if (sites[i].task == NULL) {
+                sites[i].task = task;
+                strncpy(sites[i].name, pcTaskGetName(task), sizeof(sites[i].name) - 1);
+            }
+            site = &sites[i];
+            break;
+        }
+    }
+    site->count++;
+    site->bytes += size;
+    portEXIT_CRITICAL_SAFE(&heapguard_lock);
+}
+
+/* Function to print only the tasks that allocated since the last report */
+static void heapguard_report(void)
+{
+    for (int i = 0; i <= HEAPGUARD_MAX_TASKS; i++) {
+        heapguard_site_t site;
+
+        portENTER_CRITICAL(&heapguard_lock);
+        site = sites[i];
+        portEXIT_CRITICAL(&heapguard_lock);
+
+        if (site.count == reported_count[i]) {
+            continue;
+        }
+        reported_count[i] = site.count;
+        printf("HEAPLOG,%lu,%s,%lu,%lu\n",
+            (unsigned long)esp_log_timestamp(),
+            site.task != NULL ? site.name : "other",
+            (unsigned long)site.count,
+            (unsigned long)site.bytes);
+    }
+}
+
+/* Report task: a background task rather than a timer, so UART output never runs on
+ * the timer service task */
+static void heapguard_task(void *pvParameters)
+{
+    TickType_t wake = xTaskGetTickCount();
+
+    for (;;) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(HEAPGUARD_REPORT_MS));
+        heapguard_report();
+    }
+}
+
+void heapguard_arm(void)
+{
+    if (armed) {
+        return;
+    }
+    /* Created before arming so the guard does not report itself */
+    xTaskCreateStatic(heapguard_task, "heapguard", HEAPGUARD_TASK_STACK_SIZE, NULL, HEAPGUARD_TASK_PRIORITY,
+                      report_task_stack, &report_task_buffer);
+    armed = true;
+    ESP_LOGI("HEAPGUARD", "[INFO] Heap guard armed, allocations from now on are reported.");
+}
+
+#endif
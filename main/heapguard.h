@@ -0,0 +1,30 @@
+#pragma once
+
+#include "sched.h"
+
+/* Heap guard (-DGATE_HEAP_GUARD=1, needs CONFIG_HEAP_USE_HOOKS from sdkconfig.static):
+ * once armed at READY, every heap allocation is attributed to the task that made it and
+ * reported as HEAPLOG,<log ms>,<task>,<count>,<bytes> lines. With
+ * GATE_HEAP_GUARD_ABORT=1 the first such allocation aborts with a backtrace instead. */
+#ifndef GATE_HEAP_GUARD
+#define GATE_HEAP_GUARD 0
+#endif
+#ifndef GATE_HEAP_GUARD_ABORT
+#define GATE_HEAP_GUARD_ABORT 0
+#endif
+
+#define HEAPGUARD_MAX_TASKS 12          /* Tasks tracked; the rest are counted as "other" */
+#define HEAPGUARD_REPORT_MS 10000       /* How often new allocations are reported */
+#define HEAPGUARD_TASK_STACK_SIZE 2560
+#define HEAPGUARD_TASK_PRIORITY SCHED_PRIORITY_BACKGROUND   /* Printing must not delay close timers */
+
+#if GATE_HEAP_GUARD
+
+/* Function to start flagging allocations; call when the system is READY */
+void heapguard_arm(void);
+
+#else
+
+#define heapguard_arm() do { } while (0)
+
+#endif
@@ -0,0 +1,254 @@
+#include "hil.h"
+
+#if GATE_HIL_CAPTURE
+
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/mcpwm_prelude.h"
+
+_Static_assert(GATE_COUNT <= 3, "One MCPWM group has three capture channels");
+
+typedef enum {
+    HIL_METRIC_OPEN_LATENCY,
+    HIL_METRIC_HOLD_ERROR,
+    HIL_METRIC_COUNT,
+} hil_metric_t;
+
+static const char *metric_names[HIL_METRIC_COUNT] = {
+    [HIL_METRIC_OPEN_LATENCY] = "open_latency",
+    [HIL_METRIC_HOLD_ERROR] = "hold_error",
+};
+
+typedef struct {
+    uint32_t bins[HIL_BINS + 2];    /* [0] underflow, [HIL_BINS + 1] overflow */
+    uint32_t count;
+    int64_t sum_us;
+    int32_t min_us;
+    int32_t max_us;
+} hil_histogram_t;
+
+typedef struct {
+    /* Capture ISR */
+    uint32_t rise_ticks;
+    uint32_t stable_width_ticks;    /* Width before the current change started */
+    /* Expectations set by the actuator, consumed by the ISR */
+    bool want_open;
+    bool want_close;
+    int64_t open_ref_us;
+    int64_t window_start_us;
+    int64_t hold_us;
+    hil_histogram_t hist[HIL_METRIC_COUNT];
+    uint32_t reported[HIL_METRIC_COUNT];
+} hil_gate_t;
+
+static const int capture_gpios[GATE_COUNT] = {
+#if HIL_LOOPBACK
+    [GATE_ID_ENTRY] = SERVO_ENTRY_GPIO,
+    [GATE_ID_EXIT] = SERVO_EXIT_GPIO,
+#else
+    [GATE_ID_ENTRY] = HIL_ENTRY_CAPTURE_GPIO,
+    [GATE_ID_EXIT] = HIL_EXIT_CAPTURE_GPIO,
+#endif
+};
+
+static hil_gate_t hil_gates[GATE_COUNT];
+static uint32_t ticks_per_us;
+static portMUX_TYPE hil_lock = portMUX_INITIALIZER_UNLOCKED;
+static TimerHandle_t report_timer;
+static StaticTimer_t report_timer_buffer;
+#if HIL_SELF_TEST
+static TimerHandle_t self_test_timer;
+static StaticTimer_t self_test_timer_buffer;
+#endif
+
+/* Function to add a sample; lock held */
+static void hil_add(hil_histogram_t *h, int32_t value_us, int32_t bin_us, int32_t offset_us)
+{
+    int32_t shifted = value_us + offset_us;
+    int32_t bin = shifted < 0 ? 0 : shifted / bin_us + 1;
+
+    if (bin > HIL_BINS) {
+        bin = HIL_BINS + 1;
+    }
+    h->bins[bin]++;
+    if (h->count == 0 || value_us < h->min_us) {
+        h->min_us = value_us;
+    }
+    if (h->count == 0 || value_us > h->max_us) {
+        h->max_us = value_us;
+    }
+    h->count++;
+    h->sum_us += value_us;
+}
+
+/* Capture ISR: measures each pulse and reports the first one that differs after a command */
+static bool IRAM_ATTR hil_on_capture(mcpwm_cap_channel_handle_t channel, const mcpwm_capture_event_data_t *edata, void *user_ctx)
+{
+    hil_gate_t *g = &hil_gates[(uintptr_t)user_ctx];
+    uint32_t width, diff;
+    int64_t now_us;
+
+    if (edata->cap_edge == MCPWM_CAP_EDGE_POS) {
+        g->rise_ticks = edata->cap_value;
+        return false;
+    }
+
+    width = edata->cap_value - g->rise_ticks;
+    diff = width > g->stable_width_ticks ? width - g->stable_width_ticks : g->stable_width_ticks - width;
+    /* An unchanged compare value still wobbles by a capture tick or two */
+    if (diff < HIL_CHANGE_US * ticks_per_us) {
+        return false;
+    }
+    g->stable_width_ticks = width;
+
+    /* Timestamp of the rising edge that started the changed pulse */
+    now_us = esp_timer_get_time() - width / ticks_per_us;
+    portENTER_CRITICAL_ISR(&hil_lock);
+    if (g->want_open) {
+        g->want_open = false;
+        hil_add(&g->hist[HIL_METRIC_OPEN_LATENCY], (int32_t)(now_us - g->open_ref_us), HIL_LATENCY_BIN_US, 0);
+    } else if (g->want_close) {
+        g->want_close = false;
+        hil_add(&g->hist[HIL_METRIC_HOLD_ERROR], (int32_t)(now_us - g->window_start_us - g->hold_us),
+                HIL_HOLD_BIN_US, HIL_HOLD_BIN_US * HIL_BINS / 2);
+    }
+    portEXIT_CRITICAL_ISR(&hil_lock);
+    return false;
+}
+
+void hil_expect_open(int id, int64_t ref_us)
+{
+    portENTER_CRITICAL(&hil_lock);
+    hil_gates[id].want_open = true;
+    hil_gates[id].want_close = false;
+    hil_gates[id].open_ref_us = ref_us;
+    portEXIT_CRITICAL(&hil_lock);
+}
+
+void hil_expect_hold(int id, int64_t window_start_us, uint32_t hold_ms)
+{
+    portENTER_CRITICAL(&hil_lock);
+    hil_gates[id].window_start_us = window_start_us;
+    hil_gates[id].hold_us = (int64_t)hold_ms * 1000;
+    portEXIT_CRITICAL(&hil_lock);
+}
+
+void hil_expect_close(int id, bool hold_expired)
+{
+    portENTER_CRITICAL(&hil_lock);
+    hil_gates[id].want_open = false;
+    /* Only a close that ends a hold window says anything about hold accuracy */
+    hil_gates[id].want_close = hold_expired && hil_gates[id].hold_us != 0;
+    portEXIT_CRITICAL(&hil_lock);
+}
+
+/* Report timer callback: prints the histograms that gained samples */
+static void hil_report(TimerHandle_t timer)
+{
+    for (int id = 0; id < GATE_COUNT; id++) {
+        for (int m = 0; m < HIL_METRIC_COUNT; m++) {
+            hil_histogram_t h;
+            int32_t bin_us = m == HIL_METRIC_OPEN_LATENCY ? HIL_LATENCY_BIN_US : HIL_HOLD_BIN_US;
+            int32_t offset_us = m == HIL_METRIC_OPEN_LATENCY ? 0 : HIL_HOLD_BIN_US * HIL_BINS / 2;
+
+            portENTER_CRITICAL(&hil_lock);
+            h = hil_gates[id].hist[m];
+            portEXIT_CRITICAL(&hil_lock);
+            if (h.count == hil_gates[id].reported[m]) {
+                continue;
+            }
+            hil_gates[id].reported[m] = h.count;
+
+            for (int b = 0; b < HIL_BINS + 2; b++) {
+                long lo, hi;
+
+                if (h.bins[b] == 0) {
+                    continue;
+                }
+                if (b == 0) {
+                    lo = hi = -offset_us;                               /* Below the first bin */
+                } else if (b == HIL_BINS + 1) {
+                    lo = hi = (long)HIL_BINS * bin_us - offset_us;      /* Above the last bin */
+                } else {
+                    lo = (long)(b - 1) * bin_us - offset_us;
+                    hi = lo + bin_us;
+                }
+                printf("HILLOG,%lu,%s,%s,%ld,%ld,%lu\n",
+                    (unsigned long)esp_log_timestamp(), gate_name(id), metric_names[m],
+                    lo, hi, (unsigned long)h.bins[b]);
+            }
+            printf("HILSTAT,%lu,%s,%s,%lu,%ld,%ld,%ld\n",
+                (unsigned long)esp_log_timestamp(), gate_name(id), metric_names[m],
+                (unsigned long)h.count, (long)h.min_us, (long)(h.sum_us / (int64_t)h.count), (long)h.max_us);
+        }
+    }
+}
+
+#if HIL_SELF_TEST
+/* Self-test timer callback: opens the next gate as if a command had just arrived */
+static void hil_self_test(TimerHandle_t timer)
+{
+    static uint8_t next_gate = 0;
+    gate_msg_t msg = {
+        .cmd = GATE_CMD_OPEN,
+        .mask = GATE_MASK(next_gate),
+        .rx_us = esp_timer_get_time(),
+    };
+
+    msg.dispatch_us = msg.rx_us;
+    gate_send(&msg);
+    next_gate = (next_gate + 1) % GATE_COUNT;
+}
+#endif
+
+void hil_init(void)
+{
+    mcpwm_cap_timer_handle_t cap_timer;
+    mcpwm_capture_timer_config_t timer_config = {
+        .group_id = 0,
+        .clk_src = MCPWM_CAPTURE_CLK_SRC_DEFAULT,
+    };
+    uint32_t resolution_hz;
+
+    ESP_ERROR_CHECK(mcpwm_new_capture_timer(&timer_config, &cap_timer));
+    ESP_ERROR_CHECK(mcpwm_capture_timer_get_resolution(cap_timer, &resolution_hz));
+    ticks_per_us = resolution_hz / 1000000;
+
+    for (int id = 0; id < GATE_COUNT; id++) {
+        mcpwm_cap_channel_handle_t channel;
+        mcpwm_capture_channel_config_t channel_config = {
+            .gpio_num = capture_gpios[id],
+            .prescale = 1,
+            .flags.pos_edge = true,
+            .flags.neg_edge = true,
+            .flags.io_loop_back = HIL_LOOPBACK,   /* Keep the generator driving the pin */
+        };
+        mcpwm_capture_event_callbacks_t callbacks = {
+            .on_cap = hil_on_capture,
+        };
+
+        ESP_ERROR_CHECK(mcpwm_new_capture_channel(cap_timer, &channel_config, &channel));
+        ESP_ERROR_CHECK(mcpwm_capture_channel_register_event_callbacks(channel, &callbacks, (void *)(uintptr_t)id));
+        ESP_ERROR_CHECK(mcpwm_capture_channel_enable(channel));
+    }
+    ESP_ERROR_CHECK(mcpwm_capture_timer_enable(cap_timer));
+    ESP_ERROR_CHECK(mcpwm_capture_timer_start(cap_timer));
+
+    report_timer = xTimerCreateStatic("hil_report", pdMS_TO_TICKS(HIL_REPORT_MS), pdTRUE,
+                                      NULL, hil_report, &report_timer_buffer);
+    xTimerStart(report_timer, 0);
+#if HIL_SELF_TEST
+    self_test_timer = xTimerCreateStatic("hil_self_test", pdMS_TO_TICKS(HIL_SELF_TEST_PERIOD_MS), pdTRUE,
+                                         NULL, hil_self_test, &self_test_timer_buffer);
+    xTimerStart(self_test_timer, 0);
+#endif
+    ESP_LOGI("HIL", "[INIT] Capturing servo pulses at %lu Hz%s.", (unsigned long)resolution_hz,
+             HIL_LOOPBACK ? " (GPIO loopback)" : "");
+}
+
+#endif
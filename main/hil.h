@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include "gate.h"
+
+/* Hardware-in-the-loop timing build (-DGATE_HIL_CAPTURE=1): MCPWM capture channels
+ * timestamp the real servo pulses, so open latency (command to first changed pulse) and
+ * hold error (hold window start to first closing pulse, minus the configured hold) are
+ * measured on the pin rather than inferred from code. Histograms are printed as
+ * HILLOG,<log ms>,<gate>,<metric>,<bin lo us>,<bin hi us>,<count> rows plus a
+ * HILSTAT,<log ms>,<gate>,<metric>,<count>,<min us>,<avg us>,<max us> summary. */
+#ifndef GATE_HIL_CAPTURE
+#define GATE_HIL_CAPTURE 0
+#endif
+
+/* 1: capture straight off the servo pins through the GPIO matrix, no wiring needed.
+ * 0: capture on separate pins jumpered to the servo outputs. */
+#ifndef HIL_LOOPBACK
+#define HIL_LOOPBACK 1
+#endif
+#define HIL_ENTRY_CAPTURE_GPIO 6
+#define HIL_EXIT_CAPTURE_GPIO 7
+
+#define HIL_CHANGE_US 2                 /* Pulse width change that counts as movement */
+#define HIL_LATENCY_BIN_US 5000         /* Open latency bins: 0..HIL_BINS * 5 ms */
+#define HIL_HOLD_BIN_US 2000            /* Hold error bins, centred on zero */
+#define HIL_BINS 40                     /* Plus one underflow and one overflow bin */
+#define HIL_REPORT_MS 30000             /* How often new samples are reported */
+
+/* Self-test: open the gates in turn from a timer so the target runs unattended */
+#ifndef HIL_SELF_TEST
+#define HIL_SELF_TEST 1
+#endif
+#define HIL_SELF_TEST_PERIOD_MS (GATE_OPEN_TIME_MS + 3000)
+
+#if GATE_HIL_CAPTURE
+
+/* Function to start capturing; call after gate_init() has set up the outputs */
+void hil_init(void);
+
+/* Functions called by the actuator as it commands a gate; ref_us is the command's
+ * receive time, window_start_us when its hold window was (re)started. hold_expired
+ * is set only for a close that ends a hold window; other moves (client closes,
+ * configuration sweeps) just cancel what was pending. */
+void hil_expect_open(int id, int64_t ref_us);
+void hil_expect_hold(int id, int64_t window_start_us, uint32_t hold_ms);
+void hil_expect_close(int id, bool hold_expired);
+
+#else
+
+#define hil_init() do { } while (0)
+#define hil_expect_open(id, ref_us) do { } while (0)
+#define hil_expect_hold(id, window_start_us, hold_ms) do { } while (0)
+#define hil_expect_close(id, hold_expired) do { } while (0)
+
+#endif
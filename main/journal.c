@@ -0,0 +1,500 @@
+#include "journal.h"
+
+#if GATE_JOURNAL
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "nvs.h"
+#include "motion.h"
+
+static const char *TAG = "JOURNAL";
+
+#define JOURNAL_SECTOR_SIZE 4096
+#define JOURNAL_SECTOR_RECORDS (JOURNAL_SECTOR_SIZE / sizeof(journal_record_t))
+#define JOURNAL_SEQ_ERASED 0xffffffffu
+#define JOURNAL_BUSY_POLL_MS 100            /* Retry interval for flash work while a gate moves */
+#define JOURNAL_RETRY_MS 2000               /* Replay retry after a lost PUBACK or a full outbox */
+#define JOURNAL_EARLY_ACKS 4                /* PUBACKs remembered while a publish call is in flight */
+
+#define JOURNAL_NOTIFY_STAGE 0x01           /* A page worth of records is staged */
+#define JOURNAL_NOTIFY_CONNECT 0x02
+#define JOURNAL_NOTIFY_ACK 0x04
+
+_Static_assert(JOURNAL_SECTOR_RECORDS % JOURNAL_PAGE_RECORDS == 0, "Pages must tile a sector");
+_Static_assert(JOURNAL_BATCH_RECORDS <= JOURNAL_SECTOR_RECORDS, "A batch never crosses a sector");
+
+static const esp_partition_t *partition;
+static const journal_record_t *map;         /* Whole partition, read-only mapping */
+static esp_partition_mmap_handle_t map_handle;
+static uint32_t slot_count;
+
+/* Journal task only */
+static uint32_t head;                       /* Next slot to program */
+static bool head_ready;                     /* Head sector is erased from head onwards */
+static bool next_ready;                     /* Sector after it has been erased ahead of time */
+static uint32_t next_seq = 1;
+static uint32_t sent_seq = 0;               /* Highest seq the broker has acknowledged */
+static uint32_t lost = 0;                   /* Unsent records erased to make room */
+static uint32_t reported_lost = 0;
+static uint32_t reported_dropped = 0;
+static uint16_t boot_id;
+
+/* Staging ring, filled from the status flush */
+static journal_record_t stage[JOURNAL_STAGE_RECORDS];
+static uint32_t stage_head = 0;
+static uint32_t stage_tail = 0;
+static volatile uint32_t stage_dropped = 0;
+static portMUX_TYPE stage_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static journal_sink_t sink_fn;
+static volatile bool connected = false;
+
+/* PUBACK matching, shared with the MQTT task. Every state publisher's PUBACK comes
+ * through journal_published(), and ours can arrive before the publish call returns its
+ * msg_id, so those seen in the meantime are kept in early[]. */
+static struct {
+    bool sending;                           /* Publish call in flight, msg_id unknown */
+    bool acked;
+    int awaited;
+    uint32_t early_count;
+    int early[JOURNAL_EARLY_ACKS];
+} ack = { .awaited = -1 };
+static portMUX_TYPE ack_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t journal_task_handle;
+static StaticTask_t journal_task_buffer;
+static StackType_t journal_task_stack[JOURNAL_TASK_STACK_SIZE];
+
+/* Function to tell whether a slot was never programmed since its sector was erased */
+static bool journal_slot_blank(uint32_t slot)
+{
+    const uint8_t *p = (const uint8_t *)&map[slot];
+
+    for (size_t i = 0; i < sizeof(journal_record_t); i++) {
+        if (p[i] != 0xff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Function to find the first unprogrammed slot of a sector; returns its end if full */
+static uint32_t journal_sector_end(uint32_t sector)
+{
+    uint32_t lo = sector * JOURNAL_SECTOR_RECORDS, hi = lo + JOURNAL_SECTOR_RECORDS;
+
+    /* Programmed slots come first. A torn record (see journal_slot_seq) is programmed
+     * but has no seq, so test the whole slot rather than the seq. */
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (!journal_slot_blank(mid)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* Function to get the seq a slot sorts by. A record torn by a reset mid-program is not
+ * blank but its seq is unset; it sorts with the valid record before it, 0 if none, which
+ * keeps each sector ordered for the binary searches. */
+static uint32_t journal_slot_seq(uint32_t slot)
+{
+    uint32_t first = slot - slot % JOURNAL_SECTOR_RECORDS;
+
+    while (map[slot].seq == JOURNAL_SEQ_ERASED) {
+        if (slot == first) {
+            return 0;
+        }
+        slot--;
+    }
+    return map[slot].seq;
+}
+
+/* Function to find the oldest slot holding a seq of at least from; false if none */
+static bool journal_find(uint32_t from, uint32_t *slot)
+{
+    uint32_t best_seq = JOURNAL_SEQ_ERASED;
+
+    for (uint32_t s = 0; s < slot_count / JOURNAL_SECTOR_RECORDS; s++) {
+        uint32_t lo = s * JOURNAL_SECTOR_RECORDS, hi = journal_sector_end(s);
+
+        if (hi == lo || journal_slot_seq(hi - 1) < from) {
+            continue;
+        }
+        /* The first slot sorting at or above from is never torn: a torn one sorts with
+         * the valid record before it */
+        while (lo < hi) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (journal_slot_seq(mid) < from) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (map[lo].seq < best_seq) {
+            best_seq = map[lo].seq;
+            *slot = lo;
+        }
+    }
+    return best_seq != JOURNAL_SEQ_ERASED;
+}
+
+/* Function to erase a sector, counting what it held that the broker never got */
+static bool journal_erase(uint32_t sector)
+{
+    uint32_t first = sector * JOURNAL_SECTOR_RECORDS, end = journal_sector_end(sector);
+
+    for (uint32_t slot = first; slot < end; slot++) {
+        if (map[slot].seq != JOURNAL_SEQ_ERASED && map[slot].seq > sent_seq) {
+            lost++;
+        }
+    }
+    if (esp_partition_erase_range(partition, first * sizeof(journal_record_t), JOURNAL_SECTOR_SIZE) != ESP_OK) {
+        ESP_LOGE(TAG, "[ERROR] Could not erase journal sector %lu.", (unsigned long)sector);
+        return false;
+    }
+    return true;
+}
+
+/* Function to program staged records a page at a time and erase ahead, only while no
+ * gate is moving. A partial page is programmed once its oldest record is JOURNAL_FLUSH_MS
+ * old; the rest of that page is programmed later without an erase. */
+static void journal_flash_work(void)
+{
+    uint32_t sectors = slot_count / JOURNAL_SECTOR_RECORDS;
+
+    while (motion_busy() == 0) {
+        journal_record_t page[JOURNAL_PAGE_RECORDS];
+        uint32_t n = JOURNAL_PAGE_RECORDS - head % JOURNAL_PAGE_RECORDS;
+        uint32_t now_ms = esp_log_timestamp();
+        uint32_t staged;
+
+        if (!head_ready) {
+            head_ready = journal_erase(head / JOURNAL_SECTOR_RECORDS);
+            if (!head_ready) {
+                break;
+            }
+        }
+        if (!next_ready) {
+            next_ready = journal_erase((head / JOURNAL_SECTOR_RECORDS + 1) % sectors);
+            if (!next_ready) {
+                break;
+            }
+        }
+
+        portENTER_CRITICAL(&stage_lock);
+        staged = stage_head - stage_tail;
+        if (staged < n) {
+            uint32_t oldest_ms = stage[stage_tail % JOURNAL_STAGE_RECORDS].timestamp_ms;
+            n = staged != 0 && now_ms - oldest_ms >= JOURNAL_FLUSH_MS ? staged : 0;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            page[i] = stage[(stage_tail + i) % JOURNAL_STAGE_RECORDS];
+        }
+        stage_tail += n;
+        portEXIT_CRITICAL(&stage_lock);
+
+        if (n == 0) {
+            break;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            page[i].seq = next_seq++;
+        }
+        /* Page aligned, so one program operation and never across a sector */
+        if (esp_partition_write(partition, head * sizeof(journal_record_t), page, n * sizeof(page[0])) != ESP_OK) {
+            ESP_LOGE(TAG, "[ERROR] Journal write failed, %lu records lost.", (unsigned long)n);
+            break;
+        }
+        head = (head + n) % slot_count;
+        if (head % JOURNAL_SECTOR_RECORDS == 0) {
+            /* Into the sector erased ahead; the one after it is erased on the next pass */
+            head_ready = next_ready;
+            next_ready = false;
+        }
+    }
+
+    if (lost != reported_lost || stage_dropped != reported_dropped) {
+        reported_lost = lost;
+        reported_dropped = stage_dropped;
+        ESP_LOGW(TAG, "[WARN] Journal overflow: %lu unsent records overwritten, %lu dropped in RAM.",
+                 (unsigned long)reported_lost, (unsigned long)reported_dropped);
+    }
+}
+
+/* Function to save the replay cursor */
+static void journal_save_cursor(void)
+{
+    nvs_handle_t nvs;
+
+    if (nvs_open(JOURNAL_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_set_u32(nvs, "sent", sent_seq);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+}
+
+/* Function to publish one batch and wait for its PUBACK. The publish copies the batch
+ * into the outbox; waiting here keeps that to one batch (see journal.h). */
+static bool journal_send(const journal_record_t *records, uint32_t n)
+{
+    TickType_t start;
+    const TickType_t timeout = pdMS_TO_TICKS(JOURNAL_ACK_TIMEOUT_MS);
+    int msg_id;
+    bool acked;
+
+    portENTER_CRITICAL(&ack_lock);
+    ack.sending = true;
+    ack.acked = false;
+    ack.early_count = 0;
+    portEXIT_CRITICAL(&ack_lock);
+
+    msg_id = sink_fn(records, n * sizeof(journal_record_t));
+
+    portENTER_CRITICAL(&ack_lock);
+    ack.sending = false;
+    ack.awaited = msg_id;
+    for (uint32_t i = 0; i < ack.early_count && i < JOURNAL_EARLY_ACKS; i++) {
+        ack.acked |= msg_id >= 0 && ack.early[i] == msg_id;
+    }
+    portEXIT_CRITICAL(&ack_lock);
+    if (msg_id < 0) {
+        return false;
+    }
+
+    start = xTaskGetTickCount();
+    for (;;) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+
+        portENTER_CRITICAL(&ack_lock);
+        acked = ack.acked;
+        portEXIT_CRITICAL(&ack_lock);
+        if (acked || !connected || elapsed >= timeout) {
+            break;
+        }
+        xTaskNotifyWait(0, JOURNAL_NOTIFY_ACK, NULL, timeout - elapsed);
+    }
+
+    portENTER_CRITICAL(&ack_lock);
+    ack.awaited = -1;
+    portEXIT_CRITICAL(&ack_lock);
+    return acked;
+}
+
+/* Function to stream unsent records to the broker, one acked batch at a time from the
+ * mapping; returns true if it stopped with records still unsent while connected */
+static bool journal_replay(void)
+{
+    bool stalled = false;
+    uint32_t batches = 0;
+    uint32_t slot;
+
+    while (connected && journal_find(sent_seq + 1, &slot)) {
+        uint32_t end = journal_sector_end(slot / JOURNAL_SECTOR_RECORDS);
+        uint32_t n = end - slot;
+
+        if (n > JOURNAL_BATCH_RECORDS) {
+            n = JOURNAL_BATCH_RECORDS;
+        }
+        /* End the batch before a torn record; the next search steps over it */
+        for (uint32_t i = 1; i < n; i++) {
+            if (map[slot + i].seq == JOURNAL_SEQ_ERASED) {
+                n = i;
+                break;
+            }
+        }
+        if (!journal_send(&map[slot], n)) {
+            /* Retried after JOURNAL_RETRY_MS, or on the next connect; the backend dedupes by seq */
+            stalled = connected;
+            break;
+        }
+        sent_seq = map[slot + n - 1].seq;
+        if (++batches % JOURNAL_CURSOR_SAVE_BATCHES == 0) {
+            journal_save_cursor();
+        }
+        /* Events keep arriving while we replay */
+        journal_flash_work();
+    }
+    if (batches % JOURNAL_CURSOR_SAVE_BATCHES != 0) {
+        journal_save_cursor();
+    }
+    if (batches != 0) {
+        ESP_LOGI(TAG, "[INFO] Journal replayed up to seq %lu.", (unsigned long)sent_seq);
+    }
+    return stalled;
+}
+
+static void journal_task(void *pvParameters)
+{
+    for (;;) {
+        uint32_t staged, oldest_ms = 0;
+        bool stalled = false;
+        TickType_t wait;
+
+        journal_flash_work();
+        if (connected) {
+            stalled = journal_replay();
+        }
+
+        portENTER_CRITICAL(&stage_lock);
+        staged = stage_head - stage_tail;
+        if (staged != 0) {
+            oldest_ms = stage[stage_tail % JOURNAL_STAGE_RECORDS].timestamp_ms;
+        }
+        portEXIT_CRITICAL(&stage_lock);
+
+        if (motion_busy() != 0 && (staged != 0 || !head_ready || !next_ready)) {
+            wait = pdMS_TO_TICKS(JOURNAL_BUSY_POLL_MS);
+        } else if (!head_ready || !next_ready) {
+            wait = pdMS_TO_TICKS(JOURNAL_FLUSH_MS);     /* Erase failed, retry later */
+        } else if (staged != 0) {
+            uint32_t age_ms = esp_log_timestamp() - oldest_ms;
+            wait = age_ms >= JOURNAL_FLUSH_MS ? 1 : pdMS_TO_TICKS(JOURNAL_FLUSH_MS - age_ms);
+        } else {
+            wait = portMAX_DELAY;           /* Nothing to do until a spill or a connect */
+        }
+        if (stalled && wait > pdMS_TO_TICKS(JOURNAL_RETRY_MS)) {
+            wait = pdMS_TO_TICKS(JOURNAL_RETRY_MS);
+        }
+        xTaskNotifyWait(0, JOURNAL_NOTIFY_STAGE | JOURNAL_NOTIFY_CONNECT, NULL, wait);
+    }
+}
+
+/* Function to find the head after a reset: the sector starting with the highest seq,
+ * then its first unprogrammed slot. A reset while programming the first record of a
+ * sector leaves it torn; that sector is never chosen, so the head stays at the end of the
+ * one before and the torn sector is erased again before use. */
+static void journal_locate(void)
+{
+    uint32_t sectors = slot_count / JOURNAL_SECTOR_RECORDS;
+    uint32_t newest = JOURNAL_SEQ_ERASED, newest_sector = 0;
+
+    for (uint32_t s = 0; s < sectors; s++) {
+        uint32_t seq = map[s * JOURNAL_SECTOR_RECORDS].seq;
+        if (seq != JOURNAL_SEQ_ERASED && (newest == JOURNAL_SEQ_ERASED || seq > newest)) {
+            newest = seq;
+            newest_sector = s;
+        }
+    }
+    if (newest == JOURNAL_SEQ_ERASED) {
+        head = 0;
+    } else {
+        /* Torn records count as programmed, so the head lands past them, and the last
+         * slot sorts by the highest valid seq in the sector */
+        head = journal_sector_end(newest_sector);
+        next_seq = journal_slot_seq(head - 1) + 1;
+        head %= slot_count;
+    }
+    /* Sectors are programmed from their first slot, so a blank first slot means erased */
+    head_ready = head % JOURNAL_SECTOR_RECORDS != 0 || journal_slot_blank(head);
+    next_ready = journal_slot_blank(((head / JOURNAL_SECTOR_RECORDS + 1) % sectors) * JOURNAL_SECTOR_RECORDS);
+}
+
+void journal_init(journal_sink_t sink)
+{
+    nvs_handle_t nvs;
+    bool first_use = true;
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, JOURNAL_PARTITION_LABEL);
+    if (partition == NULL || partition->size < 3 * JOURNAL_SECTOR_SIZE) {
+        ESP_LOGW(TAG, "[WARN] No journal partition, offline events will be dropped.");
+        return;
+    }
+    if (esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA,
+                           (const void **)&map, &map_handle) != ESP_OK) {
+        ESP_LOGE(TAG, "[ERROR] Could not map the journal partition.");
+        return;
+    }
+    slot_count = partition->size / JOURNAL_SECTOR_SIZE * JOURNAL_SECTOR_RECORDS;
+
+    if (nvs_open(JOURNAL_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        uint32_t address = 0;
+
+        first_use = nvs_get_u16(nvs, "boot", &boot_id) != ESP_OK;
+        nvs_get_u32(nvs, "sent", &sent_seq);
+        /* A new partition table can move the journal onto flash that held something else */
+        first_use |= nvs_get_u32(nvs, "addr", &address) != ESP_OK || address != partition->address;
+        boot_id++;
+        nvs_set_u16(nvs, "boot", boot_id);
+        nvs_set_u32(nvs, "addr", partition->address);
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+    /* Whatever a fresh partition holds is not ours; one full erase, once per device */
+    if (first_use) {
+        ESP_LOGI(TAG, "[INIT] Erasing the journal partition...");
+        esp_partition_erase_range(partition, 0, partition->size);
+        sent_seq = 0;
+    }
+    journal_locate();
+
+    sink_fn = sink;
+    journal_task_handle = xTaskCreateStatic(journal_task, "journal", JOURNAL_TASK_STACK_SIZE, NULL,
+                                            JOURNAL_TASK_PRIORITY, journal_task_stack, &journal_task_buffer);
+    ESP_LOGI(TAG, "[INIT] Journal: %lu records, head %lu, next seq %lu, sent %lu, boot %u.",
+             (unsigned long)slot_count, (unsigned long)head, (unsigned long)next_seq,
+             (unsigned long)sent_seq, boot_id);
+}
+
+void journal_append(uint8_t gate, status_event_t event, bool has_request_id, uint32_t request_id,
+                    uint32_t timestamp_ms)
+{
+    journal_record_t record = {
+        .timestamp_ms = timestamp_ms,
+        .request_id = has_request_id ? request_id : 0,
+        .boot = boot_id,
+        .gate = gate,
+        .event = (uint8_t)event | (has_request_id ? JOURNAL_HAS_REQUEST_ID : 0),
+        .seq = JOURNAL_SEQ_ERASED,          /* Assigned when programmed */
+    };
+    uint32_t staged = 0;
+
+    if (journal_task_handle == NULL) {
+        return;
+    }
+    portENTER_CRITICAL(&stage_lock);
+    if (stage_head - stage_tail < JOURNAL_STAGE_RECORDS) {
+        stage[stage_head % JOURNAL_STAGE_RECORDS] = record;
+        stage_head++;
+        staged = stage_head - stage_tail;
+    } else {
+        stage_dropped++;
+    }
+    portEXIT_CRITICAL(&stage_lock);
+
+    /* The first record arms the task's flush timeout, a page worth is programmed at once */
+    if (staged == 1 || staged == JOURNAL_PAGE_RECORDS) {
+        xTaskNotify(journal_task_handle, JOURNAL_NOTIFY_STAGE, eSetBits);
+    }
+}
+
+void journal_set_connected(bool is_connected)
+{
+    connected = is_connected;
+    if (is_connected && journal_task_handle != NULL) {
+        xTaskNotify(journal_task_handle, JOURNAL_NOTIFY_CONNECT, eSetBits);
+    }
+}
+
+void journal_published(int msg_id)
+{
+    bool ours = false;
+
+    portENTER_CRITICAL(&ack_lock);
+    if (ack.sending) {
+        ack.early[ack.early_count++ % JOURNAL_EARLY_ACKS] = msg_id;
+    } else if (msg_id == ack.awaited && !ack.acked) {
+        ack.acked = ours = true;
+    }
+    portEXIT_CRITICAL(&ack_lock);
+
+    /* Other publishers' PUBACKs do not wake the journal task */
+    if (ours && journal_task_handle != NULL) {
+        xTaskNotify(journal_task_handle, JOURNAL_NOTIFY_ACK, eSetBits);
+    }
+}
+
+#endif
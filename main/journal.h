@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "status.h"
+#include "sched.h"
+
+/* Offline event journal: state events that cannot be published are appended to the
+ * "journal" flash partition and replayed to the broker in batches once it is back.
+ *
+ * The partition is a ring of 4 KB sectors written strictly in order, so every sector is
+ * erased once per lap (wear levelling without a translation layer). Records are staged
+ * in RAM and programmed a page at a time by a low-priority task, and the sector after
+ * the head is erased ahead of time, both only while no gate is moving: with one core,
+ * a flash operation stalls everything that runs from flash. Replay reads the partition
+ * through esp_partition_mmap() and hands the mapped records to the publish, so there is
+ * no RAM staging copy of our own.
+ *
+ * Replay is not zero-copy: a QoS 1 publish copies the message into the esp-mqtt outbox,
+ * which holds it until the PUBACK. The outbox still bounds heap for a full-journal
+ * replay: one batch (JOURNAL_BATCH_RECORDS, 512 bytes plus header) is in flight at a
+ * time, because the next is published only after the PUBACK frees the last. A batch that
+ * times out stays queued until its outbox entry expires
+ * (CONFIG_MQTT_OUTBOX_EXPIRED_TIMEOUT_MS, 30 s by default). A resend comes every
+ * JOURNAL_ACK_TIMEOUT_MS plus the 2 s retry, so that is at most five copies, under 3 KB.
+ *
+ * Replay payload on parking/gate/<client id>/journal: journal_record_t * n, little endian. */
+#ifndef GATE_JOURNAL
+#define GATE_JOURNAL 1
+#endif
+
+#define JOURNAL_PARTITION_LABEL "journal"
+#define JOURNAL_NVS_NAMESPACE "journal"
+#define JOURNAL_STAGE_RECORDS 64            /* RAM staging ring, four pages */
+#define JOURNAL_PAGE_RECORDS 16             /* One 256-byte flash page */
+#define JOURNAL_FLUSH_MS 2000               /* Longest a staged record waits for flash */
+#define JOURNAL_BATCH_RECORDS 32            /* Records per replay message (512 bytes) */
+#define JOURNAL_ACK_TIMEOUT_MS 5000         /* PUBACK wait before a batch is resent */
+#define JOURNAL_CURSOR_SAVE_BATCHES 8       /* Acked batches between cursor writes to NVS */
+#define JOURNAL_TASK_STACK_SIZE 3072
+#define JOURNAL_TASK_PRIORITY SCHED_PRIORITY_JOURNAL
+
+#define JOURNAL_HAS_REQUEST_ID 0x80         /* Set in event when request_id is valid */
+
+typedef struct __attribute__((packed)) {
+    uint32_t timestamp_ms;                  /* esp_log_timestamp() in boot number "boot" */
+    uint32_t request_id;
+    uint16_t boot;
+    uint8_t gate;                           /* Gate id or STATUS_GATE_DEVICE */
+    uint8_t event;                          /* status_event_t | JOURNAL_HAS_REQUEST_ID */
+    uint32_t seq;                           /* Last: flash programs in address order, so a
+                                             * record whose seq is set is complete */
+} journal_record_t;
+
+_Static_assert(sizeof(journal_record_t) == 16, "journal_record_t must tile a flash page");
+
+/* Publishes one replay batch; returns the MQTT message ID, or -1 if it was not sent */
+typedef int (*journal_sink_t)(const void *records, size_t len);
+
+#if GATE_JOURNAL
+
+/* Function to map the partition, find the head and start the journal task; after NVS */
+void journal_init(journal_sink_t sink);
+
+/* Status spill: stages one event for flash; never blocks, drops if the stage is full */
+void journal_append(uint8_t gate, status_event_t event, bool has_request_id, uint32_t request_id,
+                    uint32_t timestamp_ms);
+
+/* Functions called from the MQTT event handler */
+void journal_set_connected(bool connected);
+void journal_published(int msg_id);
+
+#else
+
+#define journal_init(sink) do { } while (0)
+#define journal_set_connected(connected) do { } while (0)
+#define journal_published(msg_id) do { } while (0)
+
+#endif
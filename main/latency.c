@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "latency.h"
+
+static const char *stage_names[LATENCY_STAGE_COUNT] = {
+    [LATENCY_STAGE_DISPATCH] = "dispatch",
+    [LATENCY_STAGE_ACTUATE] = "actuate",
+    [LATENCY_STAGE_TOTAL] = "total",
+};
+
+static uint32_t clamp_us(int64_t delta_us)
+{
+    if (delta_us < 0) {
+        return 0;
+    }
+    return delta_us > UINT32_MAX ? UINT32_MAX : (uint32_t)delta_us;
+}
+
+void latency_record(latency_ring_t *ring, int64_t rx_us, int64_t dispatch_us, int64_t pwm_us)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    latency_sample_t *sample = &ring->samples[head % LATENCY_RING_SIZE];
+
+    sample->stage_us[LATENCY_STAGE_DISPATCH] = clamp_us(dispatch_us - rx_us);
+    sample->stage_us[LATENCY_STAGE_ACTUATE] = clamp_us(pwm_us - dispatch_us);
+    sample->stage_us[LATENCY_STAGE_TOTAL] = clamp_us(pwm_us - rx_us);
+
+    /* Publish the sample only after it is fully written */
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void latency_get_stats(const latency_ring_t *ring, latency_stage_t stage, latency_stats_t *stats)
+{
+    uint32_t values[LATENCY_RING_SIZE];
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t count = head < LATENCY_RING_SIZE ? head : LATENCY_RING_SIZE;
+    uint64_t sum = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    if (count == 0) {
+        return;
+    }
+
+    /* Insertion sort of at most LATENCY_RING_SIZE values; runs off the hot path */
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t value = ring->samples[(head - 1 - i) % LATENCY_RING_SIZE].stage_us[stage];
+        uint32_t j = i;
+
+        sum += value;
+        while (j > 0 && values[j - 1] > value) {
+            values[j] = values[j - 1];
+            j--;
+        }
+        values[j] = value;
+    }
+
+    stats->count = count;
+    stats->min_us = values[0];
+    stats->max_us = values[count - 1];
+    stats->avg_us = (uint32_t)(sum / count);
+    stats->p99_us = values[(count * 99 - 1) / 100];
+}
+
+void latency_get_histogram(const latency_ring_t *ring, latency_stage_t stage, uint16_t buckets[LATENCY_HIST_BUCKETS])
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t count = head < LATENCY_RING_SIZE ? head : LATENCY_RING_SIZE;
+
+    memset(buckets, 0, LATENCY_HIST_BUCKETS * sizeof(buckets[0]));
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t value = ring->samples[(head - 1 - i) % LATENCY_RING_SIZE].stage_us[stage];
+        int b = 0;
+
+        while (b < LATENCY_HIST_BUCKETS - 1 && value >= ((uint32_t)LATENCY_HIST_BASE_US << b)) {
+            b++;
+        }
+        buckets[b]++;
+    }
+}
+
+void latency_report(const latency_ring_t *ring, const char *gate_name)
+{
+    latency_stats_t stats;
+    uint32_t timestamp = esp_log_timestamp();
+
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+        latency_get_stats(ring, (latency_stage_t)stage, &stats);
+        printf("LATLOG,%lu,%s,%s,%lu,%lu,%lu,%lu,%lu\n",
+            (unsigned long)timestamp,
+            gate_name,
+            stage_names[stage],
+            (unsigned long)stats.count,
+            (unsigned long)stats.min_us,
+            (unsigned long)stats.avg_us,
+            (unsigned long)stats.p99_us,
+            (unsigned long)stats.max_us);
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Number of open operations kept per gate for latency statistics */
+#define LATENCY_RING_SIZE 128
+
+/* Histogram buckets: bucket i counts samples below LATENCY_HIST_BASE_US << i, the last
+ * one everything above (250 us, 500 us, ... 16 ms, more) */
+#define LATENCY_HIST_BUCKETS 8
+#define LATENCY_HIST_BASE_US 250
+
+/* Stages of an open, measured with esp_timer_get_time() */
+typedef enum {
+    LATENCY_STAGE_DISPATCH,     /* MQTT_EVENT_DATA -> gate control task */
+    LATENCY_STAGE_ACTUATE,      /* Gate control task -> servo PWM update */
+    LATENCY_STAGE_TOTAL,        /* MQTT_EVENT_DATA -> servo PWM update */
+    LATENCY_STAGE_COUNT,
+} latency_stage_t;
+
+typedef struct {
+    uint32_t stage_us[LATENCY_STAGE_COUNT];
+} latency_sample_t;
+
+/* Single-producer ring: only the owning gate task records, any task may read.
+ * A reader racing a writer that laps it can see one torn sample, which is
+ * acceptable for statistics and keeps the hot path free of locks. */
+typedef struct {
+    latency_sample_t samples[LATENCY_RING_SIZE];
+    uint32_t head;              /* Total samples ever recorded */
+} latency_ring_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t avg_us;
+    uint32_t p99_us;
+    uint32_t max_us;
+} latency_stats_t;
+
+/* Record one open from its three timestamps (microseconds since boot) */
+void latency_record(latency_ring_t *ring, int64_t rx_us, int64_t dispatch_us, int64_t pwm_us);
+
+/* Compute statistics over the samples currently held in the ring */
+void latency_get_stats(const latency_ring_t *ring, latency_stage_t stage, latency_stats_t *stats);
+
+/* Bucket the samples currently held in the ring, see LATENCY_HIST_BUCKETS */
+void latency_get_histogram(const latency_ring_t *ring, latency_stage_t stage, uint16_t buckets[LATENCY_HIST_BUCKETS]);
+
+/* Print one LATLOG line per stage for the given gate */
+void latency_report(const latency_ring_t *ring, const char *gate_name);
@@ -4,7 +4,9 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "freertos/event_groups.h"
+#include "freertos/timers.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
 #include "esp_system.h"
@@ -12,133 +14,738 @@
 #include "esp_netif.h"
 #include "esp_event.h"
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
 #include "esp_system.h"
 #include "nvs_flash.h"
-#include "driver/mcpwm.h"
+#include "nvs.h"
+#include "esp_pm.h"
+#include "esp_mac.h"
 #include "mqtt_client.h"
+#if MQTT_USE_V5
+#include "mqtt5_client.h"
+#endif
+#include "gate.h"
+#include "sched.h"
+#include "gate_config.h"
+#include "telemetry.h"
+#include "boot.h"
+#include "command.h"
+#include "status.h"
+#include "memprof.h"
+#include "heapguard.h"
+#include "hil.h"
+#include "allowlist.h"
+#include "journal.h"
+#include "espnow.h"
+#include "metrics.h"
+#include "supervisor.h"
+#include "mqtt_tls.h"
 
 /* WiFi configuration */
 #define WIFI_SSID "Ze"
 #define WIFI_PASS "987654321"
-#define WIFI_MAXIMUM_RETRY 10
+#define WIFI_RETRY_MIN_MS 250          /* First delayed retry; the first one after a drop is immediate */
+#define WIFI_RETRY_MAX_MS 8000         /* Backoff cap; retries never stop */
+#define WIFI_TIMER_CMD_WAIT_MS 50      /* Room in the timer command queue for the retry timer */
+
+/* Fast connect: remember the last good BSSID, channel and IP lease in NVS and try a
+ * direct association with that static IP before falling back to a scan plus DHCP.
+ * Assumes the AP keeps handing us the same lease (reservation or long lease time). */
+#ifndef WIFI_FAST_CONNECT
+#define WIFI_FAST_CONNECT 1
+#endif
+#define WIFI_FAST_CONNECT_ATTEMPTS 2   /* Direct attempts before a full scan */
+#define WIFI_CACHE_NAMESPACE "wifi_fast"
+#define WIFI_CACHE_KEY "cache"
+#define WIFI_CACHE_VERSION 1
 
 /* MQTT configuration */
 #define MQTT_BROKER_ADDRESS "138.199.217.16"
 #define MQTT_BROKER_PORT 1883
+#define MQTT_BROKER_TLS_PORT 8883       /* MQTTS, used when MQTT_USE_TLS (mqtt_tls.h) */
+#define MQTT_TLS_COMMON_NAME MQTT_BROKER_ADDRESS    /* Name the broker certificate must carry */
 #define MQTT_USERNAME "parkers"
 #define MQTT_PASSWORD "parkers"
-#define MQTT_TOPIC_ENTRY "parking/gate/entry"
-#define MQTT_TOPIC_EXIT "parking/gate/exit"
-
-/* Servo configuration */
-#define SERVO_MIN_PULSEWIDTH 600     /* Minimum pulse width in microseconds */
-#define SERVO_MAX_PULSEWIDTH 2400    /* Maximum pulse width in microseconds */
-#define SERVO_MAX_DEGREE 180         /* Maximum angle in degrees */
-#define SERVO_ENTRY_GPIO 5           /* GPIO for entry gate servo */
-#define SERVO_EXIT_GPIO 18           /* GPIO for exit gate servo */
-
-/* Gate configuration */
-#define GATE_OPEN_ANGLE1 90             /* Angle when entry gate is open */
-#define GATE_CLOSED_ANGLE_1 180         /* Angle for entry servo motor when gate is open */
-#define GATE_OPEN_ANGLE2 90            /* Angle when exit gate is open */
-#define GATE_CLOSED_ANGLE_2 180          /* Angle for exit servo motor when gate is closed */
-#define GATE_OPEN_TIME_MS 5000          /* Time to keep gate open in milliseconds */
+#define MQTT_TOPIC_PREFIX "parking/gate/"          /* Gate command topics are this prefix plus a lane name */
+#define MQTT_TOPIC_GATES MQTT_TOPIC_PREFIX "+"      /* One wildcard subscription covers every lane */
+#define MQTT_TOPIC_TELEMETRY "parking/telemetry/gate"   /* Kept outside the wildcard above */
+#define MQTT_TOPIC_ALLOWLIST "parking/allowlist"        /* Allow-list syncs, shared by every controller */
+#define MQTT_CLIENT_ID_PREFIX "gate-"   /* Client ID is this prefix plus the STA MAC */
+#define MQTT_TOPIC_STATE_SUFFIX "/state"    /* parking/gate/<client id>/state, outside the wildcard */
+#define MQTT_STATE_QOS 1                /* Acks must survive a reconnect; the backend dedupes by request ID */
+#define MQTT_TOPIC_JOURNAL_SUFFIX "/journal"    /* Offline events replayed from flash, see journal.h */
+#define MQTT_TOPIC_METRICS_SUFFIX "/metrics"    /* Health snapshots, see metrics.h */
+#define MQTT_TOPIC_CONFIG_SUFFIX "/config"      /* Gate parameters, see gate_config.h */
+#define MQTT_TOPIC_ALIVE_SUFFIX "/alive"        /* Supervisor heartbeats, see supervisor.h */
+
+/* Messages larger than the esp-mqtt buffer arrive as several MQTT_EVENT_DATA chunks and
+ * are rebuilt here; anything larger than the arena is skipped chunk by chunk */
+#define MQTT_BUFFER_SIZE 1024           /* esp-mqtt receive buffer (its default) */
+#define MQTT_OUT_BUFFER_SIZE 768        /* esp-mqtt send buffer: a full status batch plus topic and header */
+#define MQTT_REASSEMBLY_SIZE 2048       /* Largest message we reassemble */
+_Static_assert(MQTT_REASSEMBLY_SIZE >= ALLOWLIST_MESSAGE_MAX, "Allow-list syncs must fit the arena (allowlist.h)");
+
+/* esp-mqtt holds its client lock for up to one network timeout while connecting or
+ * writing, and the supervisor enqueues its heartbeat under that lock from a watched task */
+#define MQTT_NETWORK_TIMEOUT_MS 5000    /* esp-mqtt's default is 10 s */
+#if GATE_SUPERVISOR
+_Static_assert(MQTT_NETWORK_TIMEOUT_MS < CONFIG_ESP_TASK_WDT_TIMEOUT_S * 1000,
+               "A slow broker must not trip the task watchdog (sdkconfig.defaults)");
+#endif
+
+#if MQTT_USE_TLS
+#if !MQTT_TLS_CA_EMBEDDED
+#error "MQTT_USE_TLS needs the broker CA in main/certs/broker_ca.pem"
+#endif
+extern const char broker_ca_pem_start[] asm("_binary_broker_ca_pem_start");
+extern const char broker_ca_pem_end[] asm("_binary_broker_ca_pem_end");
+#endif
+
+/* Persistent session: the broker keeps our QoS 1 subscriptions and queues commands
+ * while we are offline, then replays them right after CONNACK */
+#ifndef MQTT_PERSISTENT_SESSION
+#define MQTT_PERSISTENT_SESSION 1
+#endif
+#if MQTT_PERSISTENT_SESSION
+#define MQTT_SUBSCRIBE_QOS 1
+#else
+#define MQTT_SUBSCRIBE_QOS 0
+#endif
+/* A resumed session only holds what the previous firmware subscribed to. Bump this when
+ * mqtt_subscriptions[] changes; a stored version that differs resubscribes on connect
+ * even when the broker kept the session. */
+#define MQTT_SUBSCRIPTION_VERSION 3
+#define MQTT_SUBSCRIPTION_NAMESPACE "mqtt"
+#define MQTT_SUBSCRIPTION_KEY "subs"
+
+/* MQTT 5 (-DMQTT_USE_V5=1, needs CONFIG_MQTT_PROTOCOL_5 from sdkconfig.mqtt5):
+ * - inbound topic aliases: after the first command on a lane the broker sends a 2-byte
+ *   alias instead of the topic; esp-mqtt maps it back before MQTT_EVENT_DATA.
+ * - receive maximum: the broker keeps at most MQTT5_RECEIVE_MAXIMUM QoS 1 commands
+ *   unacknowledged. esp-mqtt acks a command as soon as the handler returns, so this only
+ *   caps how many arrive back to back; the dispatch queue, GATE_DISPATCH_QUEUE_LENGTH
+ *   deep, absorbs that and anything beyond it is answered with STATUS_EVT_BUSY.
+ * - correlation data: a 4-byte little endian request ID beside the payload, used when
+ *   the command itself carries none.
+ * No outbound aliases: our QoS 1 state and journal messages sit in the outbox and are
+ * resent after a reconnect, where an alias from the old connection is a protocol error,
+ * and the publish property is a one-shot client setting shared by four tasks. */
+#ifndef MQTT_USE_V5
+#define MQTT_USE_V5 0
+#endif
+#define MQTT5_SESSION_EXPIRY_S 86400    /* How long the broker keeps a persistent session */
+#define MQTT5_RECEIVE_MAXIMUM GATE_DISPATCH_QUEUE_LENGTH
+#define MQTT5_TOPIC_ALIAS_MAXIMUM 16    /* Inbound aliases the broker may assign */
+#define MQTT5_MAX_PACKET_SIZE (MQTT_REASSEMBLY_SIZE + 256)  /* Larger ones are never sent to us */
+
+#if MQTT_USE_V5 && !CONFIG_MQTT_PROTOCOL_5
+#error "MQTT_USE_V5 needs CONFIG_MQTT_PROTOCOL_5 (sdkconfig.mqtt5)"
+#endif
+
+/* Set to 1 to publish telemetry records over MQTT in binary batches instead of MEMLOG lines */
+#ifndef GATE_TELEMETRY_MQTT
+#define GATE_TELEMETRY_MQTT 0
+#endif
+
+/* Power management (GATE_POWER_SAVE is defined in gate.h) */
+#define PM_MAX_CPU_FREQ_MHZ 160         /* CPU clock while a gate is moving or held open */
+#define PM_MIN_CPU_FREQ_MHZ 40          /* CPU clock while idle (XTAL) */
+#define WIFI_PS_MODE WIFI_PS_MIN_MODEM  /* Wake the radio for every DTIM beacon */
+#define WIFI_LISTEN_INTERVAL 3          /* Beacon intervals between wakeups, used by WIFI_PS_MAX_MODEM */
+
+/* Gate control (dispatch) task configuration */
+#define GATE_CONTROL_TASK_STACK_SIZE 2048   /* Stack size of the gate control task in bytes */
+#define GATE_CONTROL_TASK_PRIORITY SCHED_PRIORITY_GATE_CONTROL   /* See sched.h */
+#define GATE_DISPATCH_QUEUE_LENGTH 8        /* Decoded requests waiting for dispatch; what paces a burst */
+
+/* Decoded gate request handed from the MQTT handler to the gate control task */
+typedef struct {
+    command_t cmd;
+    gate_mask_t mask;
+    int64_t rx_us;                  /* esp_timer time at MQTT_EVENT_DATA */
+} gate_request_t;
 
 static const char *TAG = "GATE_SYSTEM";
 static EventGroupHandle_t wifi_event_group;
+static StaticEventGroup_t wifi_event_group_buffer;
 
 #define WIFI_CONNECTED_BIT BIT0
-#define WIFI_FAIL_BIT      BIT1
+#define MQTT_CLIENT_READY_BIT BIT2      /* mqtt_init() has constructed the client */
 
-static int s_retry_num = 0;
+/* Last good association, persisted as one NVS blob */
+typedef struct {
+    uint8_t version;
+    uint8_t channel;
+    uint8_t bssid[6];
+    esp_netif_ip_info_t ip_info;    /* Broker is an IP literal, so no DNS server is kept */
+} wifi_cache_t;
+
+static esp_netif_t *sta_netif;
+static wifi_cache_t wifi_cache;
+static bool wifi_cache_valid = false;
+static bool wifi_fast_active = false;   /* Current attempt uses the cached BSSID and static IP */
+static bool wifi_link_up = false;
+static uint8_t wifi_fast_failures = 0;
+static uint32_t wifi_retry_count = 0;
+static uint8_t wifi_connected_bssid[6];
+static uint8_t wifi_connected_channel;
+static TimerHandle_t wifi_retry_timer;
+static StaticTimer_t wifi_retry_timer_buffer;
+static volatile bool wifi_restarting = false;   /* Set by a supervisor restart until STA_START */
 static esp_mqtt_client_handle_t mqtt_client = NULL;
+static volatile bool mqtt_connected = false;
+static bool mqtt_started = false;
+static char mqtt_client_id[sizeof(MQTT_CLIENT_ID_PREFIX) + 12];
+static char mqtt_state_topic[sizeof(MQTT_TOPIC_PREFIX) + sizeof(mqtt_client_id) + sizeof(MQTT_TOPIC_STATE_SUFFIX)];
+#if GATE_JOURNAL
+static char mqtt_journal_topic[sizeof(MQTT_TOPIC_PREFIX) + sizeof(mqtt_client_id) + sizeof(MQTT_TOPIC_JOURNAL_SUFFIX)];
+#endif
+static char mqtt_config_topic[sizeof(MQTT_TOPIC_PREFIX) + sizeof(mqtt_client_id) + sizeof(MQTT_TOPIC_CONFIG_SUFFIX)];
+#if GATE_SUPERVISOR
+static char mqtt_alive_topic[sizeof(MQTT_TOPIC_PREFIX) + sizeof(mqtt_client_id) + sizeof(MQTT_TOPIC_ALIVE_SUFFIX)];
+#endif
+static int mqtt_config_topic_len;
+static const char *const mqtt_subscriptions[] = {MQTT_TOPIC_GATES, MQTT_TOPIC_ALLOWLIST, mqtt_config_topic};
+static uint32_t mqtt_subscription_version = 0;  /* Last set the broker acked, from NVS */
+static size_t mqtt_subscriptions_pending = 0;   /* SUBACKs still due; MQTT task only */
+#if GATE_METRICS
+static char mqtt_metrics_topic[sizeof(MQTT_TOPIC_PREFIX) + sizeof(mqtt_client_id) + sizeof(MQTT_TOPIC_METRICS_SUFFIX)];
+#endif
+
+/* Counters for metrics.h; each has a single writer */
+static volatile uint32_t commands_mqtt = 0;     /* MQTT task */
+static volatile uint32_t commands_espnow = 0;   /* Wi-Fi task */
+static volatile uint32_t mqtt_connects = 0;     /* MQTT task */
+static volatile uint32_t mqtt_disconnects = 0;  /* MQTT task */
+static volatile uint32_t wifi_disconnects = 0;  /* Event loop task */
+
+static QueueHandle_t dispatch_queue;
+static StaticQueue_t dispatch_queue_buffer;
+static uint8_t dispatch_queue_storage[GATE_DISPATCH_QUEUE_LENGTH * sizeof(gate_request_t)];
+static StaticTask_t gate_control_task_buffer;
+static StackType_t gate_control_task_stack[GATE_CONTROL_TASK_STACK_SIZE];
+static volatile uint32_t dispatch_dropped = 0;
+
+/* Reassembly state for a chunked message. One arena is enough: there is one connection
+ * and the MQTT task delivers a message's chunks in order, without interleaving. Only
+ * allow-list and config messages are reassembled; a gate command is at most
+ * COMMAND_MAX_LEN bytes, so one that arrives in chunks is dropped at the first. */
+typedef struct {
+    bool active;                    /* Collecting chunks into reassembly_buf */
+    bool skipping;                  /* Discarding the rest of an unwanted message */
+    bool allowlist;                 /* From the topic, which only the first chunk carries */
+    bool config;
+    int total_len;
+    int received;
+} mqtt_reassembly_t;
+
+static mqtt_reassembly_t reassembly;
+static char reassembly_buf[MQTT_REASSEMBLY_SIZE];
+static volatile uint32_t reassembly_dropped = 0;
+
+/* Lane topics: suffix after MQTT_TOPIC_PREFIX and the gates it moves together.
+ * Adding a lane only needs an entry here. */
+#define GATE_TOPIC_TABLE(X)                     \
+    X("entry", GATE_MASK(GATE_ID_ENTRY))        \
+    X("exit", GATE_MASK(GATE_ID_EXIT))
+
+typedef struct {
+    const char *suffix;
+    uint8_t len;
+    gate_mask_t mask;
+} gate_topic_t;
+
+#define GATE_TOPIC_ENTRY(suffix, mask) { suffix, sizeof(suffix) - 1, mask },
+static const gate_topic_t gate_topics[] = {
+    GATE_TOPIC_TABLE(GATE_TOPIC_ENTRY)
+};
+#undef GATE_TOPIC_ENTRY
+
+#define GATE_TOPIC_COUNT (sizeof(gate_topics) / sizeof(gate_topics[0]))
+#define GATE_TOPIC_SLOTS 16             /* Open-addressed hash slots, power of two */
+_Static_assert(GATE_TOPIC_COUNT * 2 <= GATE_TOPIC_SLOTS, "GATE_TOPIC_SLOTS too small for the lane table");
+
+static int8_t gate_topic_slots[GATE_TOPIC_SLOTS];  /* Index into gate_topics, -1 if empty */
+
+/* Hash of a lane suffix from its length and first/last characters: no loop over the string */
+static inline uint32_t gate_topic_hash(const char *suffix, size_t len)
+{
+    return ((uint32_t)len * 31u + (uint8_t)suffix[0] * 7u + (uint8_t)suffix[len - 1]) & (GATE_TOPIC_SLOTS - 1);
+}
+
+/* Function to build the topic hash table from the lane table */
+static void gate_topics_init(void)
+{
+    memset(gate_topic_slots, -1, sizeof(gate_topic_slots));
+    for (size_t i = 0; i < GATE_TOPIC_COUNT; i++) {
+        uint32_t slot = gate_topic_hash(gate_topics[i].suffix, gate_topics[i].len);
+        while (gate_topic_slots[slot] >= 0) {
+            slot = (slot + 1) & (GATE_TOPIC_SLOTS - 1);
+        }
+        gate_topic_slots[slot] = (int8_t)i;
+    }
+}
+
+/* Function to map an MQTT topic to its gates; requires an exact match, not a prefix */
+static gate_mask_t gate_topic_lookup(const char *topic, int topic_len)
+{
+    const size_t prefix_len = sizeof(MQTT_TOPIC_PREFIX) - 1;
+
+    if (topic_len <= (int)prefix_len || memcmp(topic, MQTT_TOPIC_PREFIX, prefix_len) != 0) {
+        return 0;
+    }
+
+    const char *suffix = topic + prefix_len;
+    size_t len = topic_len - prefix_len;
+    uint32_t slot = gate_topic_hash(suffix, len);
+
+    while (gate_topic_slots[slot] >= 0) {
+        const gate_topic_t *entry = &gate_topics[gate_topic_slots[slot]];
+        if (entry->len == len && memcmp(entry->suffix, suffix, len) == 0) {
+            return entry->mask;
+        }
+        slot = (slot + 1) & (GATE_TOPIC_SLOTS - 1);
+    }
+    return 0;
+}
+
+/* Gate control task: logs and routes decoded requests off the MQTT task */
+static void gate_control_task(void *pvParameters)
+{
+    gate_request_t req;
+    uint32_t reported_dropped = 0;
+    uint32_t reported_oversized = 0;
+    uint32_t reported_espnow = 0;
+
+    supervisor_watch();
+    for (;;) {
+        supervisor_beat();
+        if (xQueueReceive(dispatch_queue, &req, SUPERVISOR_WAIT(portMAX_DELAY)) != pdTRUE) {
+            continue;
+        }
+
+        if (dispatch_dropped != reported_dropped) {
+            reported_dropped = dispatch_dropped;
+            ESP_LOGW(TAG, "[WARN] Dispatch queue overflowed, %lu requests dropped so far.",
+                     (unsigned long)reported_dropped);
+        }
+        if (reassembly_dropped != reported_oversized) {
+            reported_oversized = reassembly_dropped;
+            ESP_LOGW(TAG, "[WARN] %lu chunked MQTT messages dropped (oversized, chunked gate command or out of order).",
+                     (unsigned long)reported_oversized);
+        }
+        if (espnow_rejected() != reported_espnow) {
+            reported_espnow = espnow_rejected();
+            ESP_LOGW(TAG, "[WARN] %lu ESP-NOW frames rejected so far.", (unsigned long)reported_espnow);
+        }
+
+        if (req.cmd.op == COMMAND_STATUS) {
+            for (int i = 0; i < GATE_COUNT; i++) {
+                if (req.mask & GATE_MASK(i)) {
+                    ESP_LOGI(TAG, "[STATUS] %s gate: %s", gate_label(i), gate_is_open(i) ? "open" : "closed");
+                    status_post(i, gate_is_open(i) ? STATUS_EVT_OPEN : STATUS_EVT_CLOSED,
+                                req.cmd.has_request_id, req.cmd.request_id);
+                }
+            }
+            continue;
+        }
+
+        /* Decided locally, so a pass still opens while the broker is unreachable;
+         * the decision is uploaded with the next status flush that gets through */
+        if (req.cmd.op == COMMAND_PASS && !allowlist_contains(req.cmd.credential)) {
+            for (int i = 0; i < GATE_COUNT; i++) {
+                if (req.mask & GATE_MASK(i)) {
+                    ESP_LOGI(TAG, "[DENY] %s gate: credential %08lx not on the allow-list", gate_label(i),
+                             (unsigned long)req.cmd.credential);
+                    status_post(i, STATUS_EVT_DENY, req.cmd.has_request_id, req.cmd.request_id);
+                }
+            }
+            continue;
+        }
+
+        gate_msg_t msg = {
+            .cmd = req.cmd.op == COMMAND_CLOSE ? GATE_CMD_CLOSE : GATE_CMD_OPEN,
+            .mask = req.mask,
+            .hold_ms = req.cmd.op == COMMAND_HOLD ? req.cmd.hold_ms : 0,
+            .has_request_id = req.cmd.has_request_id,
+            .request_id = req.cmd.request_id,
+            .rx_us = req.rx_us,
+            .dispatch_us = esp_timer_get_time(),
+        };
+        bool queued = gate_send(&msg);
+
+        for (int i = 0; i < GATE_COUNT; i++) {
+            if (!(req.mask & GATE_MASK(i))) {
+                continue;
+            }
+            status_post(i, !queued ? STATUS_EVT_BUSY : req.cmd.op == COMMAND_PASS ? STATUS_EVT_ALLOW : STATUS_EVT_ACK,
+                        req.cmd.has_request_id, req.cmd.request_id);
+            if (queued) {
+                ESP_LOGI(TAG, "[DISPATCH] %s gate: %s (request %lu)", gate_label(i),
+                         msg.cmd == GATE_CMD_OPEN ? "open" : "close",
+                         req.cmd.has_request_id ? (unsigned long)req.cmd.request_id : 0ul);
+            } else {
+                ESP_LOGW(TAG, "[WARN] Gate queue full, %s gate command dropped.", gate_label(i));
+            }
+        }
+    }
+}
+
+/* Function to start the gate control task and its dispatch queue */
+static void gate_control_start(void)
+{
+    dispatch_queue = xQueueCreateStatic(GATE_DISPATCH_QUEUE_LENGTH, sizeof(gate_request_t),
+                                        dispatch_queue_storage, &dispatch_queue_buffer);
+    xTaskCreateStatic(gate_control_task, "gate_control", GATE_CONTROL_TASK_STACK_SIZE, NULL,
+                      GATE_CONTROL_TASK_PRIORITY, gate_control_task_stack, &gate_control_task_buffer);
+}
+
+/* Function to post a decoded request for dispatch without waiting; safe to call from
+ * the MQTT and Wi-Fi tasks, neither of which may stall on a burst */
+static void gate_dispatch(gate_mask_t mask, const command_t *cmd, int64_t rx_us)
+{
+    gate_request_t req = {
+        .cmd = *cmd,
+        .mask = mask,
+        .rx_us = rx_us,
+    };
+
+    if (xQueueSend(dispatch_queue, &req, 0) != pdTRUE) {
+        /* Never log on the caller's task; the control task reports the count */
+        dispatch_dropped++;
+        /* The sender must not mistake the drop for a lost message, so answer each gate */
+        for (int i = 0; i < GATE_COUNT; i++) {
+            if (mask & GATE_MASK(i)) {
+                status_post(i, STATUS_EVT_BUSY, cmd->has_request_id, cmd->request_id);
+            }
+        }
+    }
+}
+
+/* Function to parse and dispatch one complete message; id is the MQTT 5 correlation ID */
+static void gate_handle_message(gate_mask_t mask, const char *data, int len, int64_t rx_us,
+                                bool has_id, uint32_t id)
+{
+    command_t cmd;
+
+    /* Bad frames are dropped silently */
+    if (mask != 0 && command_parse(data, len, &cmd)) {
+        if (!cmd.has_request_id && has_id) {
+            cmd.has_request_id = true;
+            cmd.request_id = id;
+        }
+        commands_mqtt++;
+        gate_dispatch(mask, &cmd, rx_us);
+    }
+}
+
+#if GATE_ESPNOW
+/* ESP-NOW dispatch: the Wi-Fi task must never wait for the queue */
+static void espnow_dispatch(gate_mask_t mask, const command_t *cmd, int64_t rx_us)
+{
+    commands_espnow++;
+    gate_dispatch(mask, cmd, rx_us);
+}
+#endif
+
+/* Function to read a request ID from MQTT 5 correlation data; false without one */
+static bool mqtt_correlation_id(esp_mqtt_event_handle_t event, uint32_t *id)
+{
+#if MQTT_USE_V5
+    const esp_mqtt5_event_property_t *property = event->property;
+
+    if (property != NULL && property->correlation_data_len == 4) {
+        const uint8_t *p = (const uint8_t *)property->correlation_data;
+        *id = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        return true;
+    }
+#endif
+    return false;
+}
+
+/* Function to apply one complete allow-list sync message; runs on the MQTT task */
+static void allowlist_handle_message(const char *data, int len)
+{
+    /* Stale and malformed syncs are dropped silently, like bad command frames */
+    if (allowlist_sync((const uint8_t *)data, (size_t)len) == ALLOWLIST_SYNC_GAP) {
+        /* Missed a delta: tell the backend where we are so it sends a full sync */
+        status_post(STATUS_GATE_DEVICE, STATUS_EVT_RESYNC, true, allowlist_seq());
+    }
+}
+
+/* Function to handle a gate config update from the MQTT task, see gate_config.h */
+static void config_handle_message(const char *data, int len)
+{
+    gate_config_update((const uint8_t *)data, (size_t)len);
+    status_post(STATUS_GATE_DEVICE, STATUS_EVT_CONFIG, true, gate_config_active()->seq);
+}
+
+/* Function to tell whether a topic carries allow-list syncs */
+static inline bool allowlist_topic(const char *topic, int topic_len)
+{
+    return topic_len == sizeof(MQTT_TOPIC_ALLOWLIST) - 1 &&
+           memcmp(topic, MQTT_TOPIC_ALLOWLIST, topic_len) == 0;
+}
+
+/* Function to tell whether a topic carries our gate configuration */
+static inline bool config_topic(const char *topic, int topic_len)
+{
+    return topic_len == mqtt_config_topic_len && memcmp(topic, mqtt_config_topic, topic_len) == 0;
+}
 
-/* Function to print memory stats */
-void print_memory_stats(char *event) {
-    uint32_t free_heap = esp_get_free_heap_size();
-    uint32_t min_free_heap = esp_get_minimum_free_heap_size();
-    
-    multi_heap_info_t info;
-    heap_caps_get_info(&info, MALLOC_CAP_DEFAULT);
-
-    printf("MEMLOG,%lu,%s,%lu,%lu,%lu,%lu,%lu\n", 
-        (unsigned long)esp_log_timestamp(),
-        event,
-        (unsigned long)free_heap, 
-        (unsigned long)min_free_heap, 
-        (unsigned long)info.total_allocated_bytes,
-        (unsigned long)info.total_free_bytes,
-        (unsigned long)info.largest_free_block);
-
-    ESP_LOGI(TAG, "--- MEMORY STATS for event: %s ---", event);
-    ESP_LOGI(TAG, "Free heap: %lu bytes", (unsigned long)esp_get_free_heap_size());
-    ESP_LOGI(TAG, "Minimum free heap ever: %lu bytes", (unsigned long)esp_get_minimum_free_heap_size());
-    ESP_LOGI(TAG, "Total allocated: %lu bytes", (unsigned long)info.total_allocated_bytes);
-    ESP_LOGI(TAG, "Total free: %lu bytes", (unsigned long)info.total_free_bytes);
-    ESP_LOGI(TAG, "Largest free block: %lu bytes", (unsigned long)info.largest_free_block);
-}
-
-/* Function to set servo angle */
-static void set_servo_angle(mcpwm_unit_t unit, mcpwm_timer_t timer, uint32_t gpio_num, uint32_t angle)
-{
-    uint32_t pulse_width_us = (SERVO_MIN_PULSEWIDTH + (((SERVO_MAX_PULSEWIDTH - SERVO_MIN_PULSEWIDTH) * angle) / SERVO_MAX_DEGREE));
-    mcpwm_set_duty_in_us(unit, timer, MCPWM_OPR_A, pulse_width_us);
-}
-
-/* Function to close entry gate after delay */
-static void close_entry_gate_task(void *pvParameters)
-{
-    vTaskDelay(pdMS_TO_TICKS(GATE_OPEN_TIME_MS));
-    ESP_LOGI(TAG, "[ACTION] Closing ENTRY gate...");
-    set_servo_angle(MCPWM_UNIT_0, MCPWM_TIMER_0, SERVO_ENTRY_GPIO, GATE_CLOSED_ANGLE_1);
-    print_memory_stats("After close entry gate");
-    vTaskDelete(NULL);
-}
-
-/* Function to open entry gate */
-static void open_entry_gate(void)
-{
-    print_memory_stats("Before open entry gate");
-    
-    ESP_LOGI(TAG, "[ACTION] Opening ENTRY gate...");
-    set_servo_angle(MCPWM_UNIT_0, MCPWM_TIMER_0, SERVO_ENTRY_GPIO, GATE_OPEN_ANGLE1);
-    
-    xTaskCreate(
-        (TaskFunction_t)&close_entry_gate_task,
-        "close_entry_gate_task",
-        2048,
-        NULL,
-        5,
-        NULL
-    );
-}
-
-/* Function to close exit gate after delay */
-static void close_exit_gate_task(void *pvParameters)
-{
-    vTaskDelay(pdMS_TO_TICKS(GATE_OPEN_TIME_MS));
-    ESP_LOGI(TAG, "[ACTION] Closing EXIT gate...");
-    set_servo_angle(MCPWM_UNIT_0, MCPWM_TIMER_1, SERVO_EXIT_GPIO, GATE_CLOSED_ANGLE_2);
-    print_memory_stats("After close exit gate");
-    vTaskDelete(NULL);
-}
-
-/* Function to open exit gate */
-static void open_exit_gate(void)
-{
-    print_memory_stats("After open exit gate");
-    
-    ESP_LOGI(TAG, "[ACTION] Opening EXIT gate...");
-    set_servo_angle(MCPWM_UNIT_0, MCPWM_TIMER_1, SERVO_EXIT_GPIO, GATE_OPEN_ANGLE2);
-
-    xTaskCreate(
-        (TaskFunction_t)&close_exit_gate_task,
-        "close_exit_gate_task",
-        2048,
-        NULL,
-        5,
-        NULL
-    );
+/* Function to handle MQTT_EVENT_DATA: whole messages are parsed in place, chunked ones
+ * are copied into the arena and parsed once the last chunk is in */
+static void mqtt_handle_data(esp_mqtt_event_handle_t event, int64_t rx_us)
+{
+    mqtt_reassembly_t *r = &reassembly;
+
+    if (event->current_data_offset == 0) {
+        if (event->data_len == event->total_data_len) {
+            r->active = r->skipping = false;
+            if (allowlist_topic(event->topic, event->topic_len)) {
+                allowlist_handle_message(event->data, event->data_len);
+                return;
+            }
+            if (config_topic(event->topic, event->topic_len)) {
+                config_handle_message(event->data, event->data_len);
+                return;
+            }
+            uint32_t id = 0;
+            bool has_id = mqtt_correlation_id(event, &id);
+
+            gate_handle_message(gate_topic_lookup(event->topic, event->topic_len),
+                                event->data, event->data_len, rx_us, has_id, id);
+            return;
+        }
+
+        /* First chunk: decide from the topic and total length whether to keep it */
+        r->allowlist = allowlist_topic(event->topic, event->topic_len);
+        r->config = !r->allowlist && config_topic(event->topic, event->topic_len);
+        r->total_len = event->total_data_len;
+        r->received = 0;
+        r->active = (r->allowlist || r->config) && r->total_len <= MQTT_REASSEMBLY_SIZE;
+        r->skipping = !r->active;
+        if (r->skipping && (r->allowlist || r->config ||
+                            gate_topic_lookup(event->topic, event->topic_len) != 0)) {
+            reassembly_dropped++;
+        }
+    } else if (r->active && event->current_data_offset != r->received) {
+        /* Lost a chunk (e.g. reconnect mid-message): give up on this one */
+        r->active = false;
+        r->skipping = true;
+        reassembly_dropped++;
+    }
+
+    if (r->skipping) {
+        if (event->current_data_offset + event->data_len >= r->total_len) {
+            r->skipping = false;
+        }
+        return;
+    }
+    if (!r->active || event->data_len > MQTT_REASSEMBLY_SIZE - r->received) {
+        r->active = false;
+        return;
+    }
+
+    memcpy(reassembly_buf + r->received, event->data, event->data_len);
+    r->received += event->data_len;
+    if (r->received == r->total_len) {
+        r->active = false;
+        if (r->allowlist) {
+            allowlist_handle_message(reassembly_buf, r->received);
+        } else {
+            config_handle_message(reassembly_buf, r->received);
+        }
+    }
+}
+
+/* Status sink: enqueues a coalesced batch for the MQTT task to send. The enqueue waits
+ * for the client lock, so this runs on the status task, never the timer service task. */
+static bool status_mqtt_sink(const char *payload, size_t len)
+{
+    if (!mqtt_connected) {
+        return false;
+    }
+    return esp_mqtt_client_enqueue(mqtt_client, mqtt_state_topic, payload, len,
+                                   MQTT_STATE_QOS, 0, true) >= 0;
+}
+
+#if GATE_JOURNAL
+/* Journal sink: publishes one replay batch from the journal task; QoS 1 so the journal
+ * only advances its cursor on PUBACK */
+static int journal_mqtt_sink(const void *records, size_t len)
+{
+    if (!mqtt_connected) {
+        return -1;
+    }
+    return esp_mqtt_client_publish(mqtt_client, mqtt_journal_topic, records, len, MQTT_STATE_QOS, 0);
+}
+#endif
+
+#if GATE_METRICS
+/* Metrics collect callback: our counters and queue depths, read without locking */
+static void metrics_collect(metrics_counters_t *counters)
+{
+    counters->commands_mqtt = commands_mqtt;
+    counters->commands_espnow = commands_espnow;
+    counters->dispatch_dropped = dispatch_dropped;
+    counters->reassembly_dropped = reassembly_dropped;
+    counters->espnow_rejected = espnow_rejected();
+    counters->mqtt_connects = mqtt_connects;
+    counters->mqtt_disconnects = mqtt_disconnects;
+    counters->wifi_disconnects = wifi_disconnects;
+    counters->dispatch_queue_depth = (uint8_t)uxQueueMessagesWaiting(dispatch_queue);
+    counters->gate_queue_depth = (uint8_t)gate_queue_depth();
+}
+
+/* Metrics sink: QoS 0, a lost snapshot is superseded by the next one */
+static bool metrics_mqtt_sink(const void *payload, size_t len)
+{
+    if (!mqtt_connected) {
+        return false;
+    }
+    return esp_mqtt_client_enqueue(mqtt_client, mqtt_metrics_topic, payload, len, 0, 0, true) >= 0;
+}
+#endif
+
+#if GATE_TELEMETRY_MQTT
+/* Telemetry sink: publishes a batch of packed records as one binary MQTT message */
+static bool telemetry_mqtt_sink(const telemetry_record_t *records, size_t count)
+{
+    if (!mqtt_connected) {
+        return false;
+    }
+    return esp_mqtt_client_publish(mqtt_client, MQTT_TOPIC_TELEMETRY, (const char *)records,
+                                   count * sizeof(telemetry_record_t), 0, 0) >= 0;
+}
+#endif
+
+#if GATE_SUPERVISOR
+static bool supervisor_wifi_up(void)
+{
+    return (xEventGroupGetBits(wifi_event_group) & WIFI_CONNECTED_BIT) != 0;
+}
+
+static bool supervisor_mqtt_connected(void)
+{
+    return mqtt_connected;
+}
+
+/* Heartbeat: QoS 1 uptime, enqueued so the supervisor never writes to the socket itself;
+ * the MQTT task sends it, so the PUBACK proves the whole path including that task */
+static int supervisor_ping(void)
+{
+    char uptime[12];
+    int len = snprintf(uptime, sizeof(uptime), "%lu", (unsigned long)(esp_log_timestamp() / 1000));
+
+    return esp_mqtt_client_enqueue(mqtt_client, mqtt_alive_topic, uptime, len, 1, 0, true);
+}
+
+static void supervisor_reconnect(void)
+{
+    if (__atomic_load_n(&mqtt_started, __ATOMIC_ACQUIRE)) {
+        esp_mqtt_client_disconnect(mqtt_client);
+        esp_mqtt_client_reconnect(mqtt_client);
+    }
+}
+
+/* Wi-Fi restart: STA_START reconnects, so the backoff retries stay out of it. The flag
+ * goes up first, so neither the disconnect the stop raises nor a retry timer that fires
+ * meanwhile can call esp_wifi_connect() on a stopping driver. */
+static void supervisor_wifi_restart(void)
+{
+    esp_err_t err;
+
+    __atomic_store_n(&wifi_restarting, true, __ATOMIC_RELEASE);
+    if (xTimerStop(wifi_retry_timer, pdMS_TO_TICKS(WIFI_TIMER_CMD_WAIT_MS)) != pdPASS) {
+        ESP_LOGW(TAG, "[WARN] Could not stop the WiFi retry timer, its callback will skip.");
+    }
+    err = esp_wifi_stop();
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "[WARN] esp_wifi_stop failed: %s", esp_err_to_name(err));
+    }
+    err = esp_wifi_start();
+    if (err != ESP_OK) {
+        /* No STA_START will come; the supervisor escalates again if the link stays down */
+        ESP_LOGE(TAG, "[ERROR] esp_wifi_start failed: %s", esp_err_to_name(err));
+        __atomic_store_n(&wifi_restarting, false, __ATOMIC_RELEASE);
+    }
+}
+
+static const supervisor_hooks_t supervisor_hooks = {
+    .wifi_up = supervisor_wifi_up,
+    .mqtt_connected = supervisor_mqtt_connected,
+    .ping = supervisor_ping,
+    .reconnect = supervisor_reconnect,
+    .wifi_restart = supervisor_wifi_restart,
+};
+#endif
+
+/* Function to start the MQTT client once it exists and we have an IP. Called by both
+ * mqtt_init() and the GOT_IP handler, whichever finishes last starts the client. */
+static void mqtt_start_when_ready(void)
+{
+    const EventBits_t ready = WIFI_CONNECTED_BIT | MQTT_CLIENT_READY_BIT;
+
+    if ((xEventGroupGetBits(wifi_event_group) & ready) != ready ||
+        __atomic_exchange_n(&mqtt_started, true, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    ESP_LOGI(TAG, "[INIT] Starting MQTT client...");
+    esp_mqtt_client_start(mqtt_client);
+}
+
+/* Function to announce READY the first time commands can reach us */
+static void gate_system_ready(void)
+{
+    if (boot_phase_us(BOOT_PHASE_READY) == 0) {
+        boot_mark(BOOT_PHASE_READY);
+        ESP_LOGI(TAG, "[INFO] Gate system READY.");
+        heapguard_arm();
+    }
+}
+
+/* Function to load the subscription set version a previous session acked */
+static void mqtt_subscriptions_load(void)
+{
+    nvs_handle_t nvs;
+
+    if (nvs_open(MQTT_SUBSCRIPTION_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;                             /* Never subscribed: the first connect does */
+    }
+    if (nvs_get_u32(nvs, MQTT_SUBSCRIPTION_KEY, &mqtt_subscription_version) != ESP_OK) {
+        mqtt_subscription_version = 0;
+    }
+    nvs_close(nvs);
+}
+
+/* Function to record that the broker acked the current subscription set */
+static void mqtt_subscriptions_store(void)
+{
+    nvs_handle_t nvs;
+
+    if (mqtt_subscription_version == MQTT_SUBSCRIPTION_VERSION ||
+        nvs_open(MQTT_SUBSCRIPTION_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_u32(nvs, MQTT_SUBSCRIPTION_KEY, MQTT_SUBSCRIPTION_VERSION) == ESP_OK && nvs_commit(nvs) == ESP_OK) {
+        mqtt_subscription_version = MQTT_SUBSCRIPTION_VERSION;
+    }
+    nvs_close(nvs);
+}
+
+/* Function to subscribe to every topic in the set; the version is stored once all are acked */
+static void mqtt_subscribe_all(void)
+{
+    size_t sent = 0;
+
+    for (size_t i = 0; i < sizeof(mqtt_subscriptions) / sizeof(mqtt_subscriptions[0]); i++) {
+        if (esp_mqtt_client_subscribe(mqtt_client, mqtt_subscriptions[i], MQTT_SUBSCRIBE_QOS) >= 0) {
+            sent++;
+        }
+    }
+    /* A failed SUBSCRIBE leaves the version unstored, so the next connect tries again */
+    mqtt_subscriptions_pending = sent == sizeof(mqtt_subscriptions) / sizeof(mqtt_subscriptions[0]) ? sent : 0;
 }
 
 /* MQTT event handler */
@@ -149,39 +756,54 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     switch (event->event_id) {
         case MQTT_EVENT_CONNECTED:
             ESP_LOGI(TAG, "--- MQTT connected ---");
-            esp_mqtt_client_subscribe(mqtt_client, MQTT_TOPIC_ENTRY, 0);
-            esp_mqtt_client_subscribe(mqtt_client, MQTT_TOPIC_EXIT, 0);
+            mqtt_connected = true;
+            mqtt_connects++;
+            journal_set_connected(true);
+            boot_mark(BOOT_PHASE_MQTT_CONNECTED);
+            /* A resumed session still holds our subscriptions, unless the set changed since
+             * they were made; then skip the SUBSCRIBE round trip */
+            if (MQTT_PERSISTENT_SESSION && event->session_present &&
+                mqtt_subscription_version == MQTT_SUBSCRIPTION_VERSION) {
+                ESP_LOGI(TAG, "--- MQTT session resumed ---");
+                gate_system_ready();
+                break;
+            }
+            mqtt_subscribe_all();
+            /* Fresh session or new topics: nothing was queued for us on them, so ask for
+             * what changed since our seq */
+            status_post(STATUS_GATE_DEVICE, STATUS_EVT_RESYNC, true, allowlist_seq());
             break;
 
         case MQTT_EVENT_DISCONNECTED:
             ESP_LOGI(TAG, "--- MQTT disconnected ---");
+            mqtt_connected = false;
+            mqtt_disconnects++;
+            journal_set_connected(false);
+            reassembly.active = reassembly.skipping = false;
+            mqtt_subscriptions_pending = 0;
             break;
 
         case MQTT_EVENT_SUBSCRIBED:
             ESP_LOGI(TAG, "--- MQTT subscribed to topic ---");
+            if (mqtt_subscriptions_pending > 0 && --mqtt_subscriptions_pending == 0) {
+                mqtt_subscriptions_store();
+            }
+            gate_system_ready();
             break;
 
         case MQTT_EVENT_UNSUBSCRIBED:
             ESP_LOGI(TAG, "--- MQTT unsubscribed from topic ---");
             break;
 
-        case MQTT_EVENT_DATA:
-            ESP_LOGI(TAG, "--- MQTT data received ---");
-
-            ESP_LOGI(TAG, "Topic: %.*s", event->topic_len, event->topic);
-            ESP_LOGI(TAG, "Data: %.*s", event->data_len, event->data);
+        case MQTT_EVENT_DATA: {
+            /* Decode only; logging and actuation happen on the gate control task */
+            mqtt_handle_data(event, esp_timer_get_time());
+            break;
+        }
 
-            if (strncmp(event->topic, MQTT_TOPIC_ENTRY, event->topic_len) == 0) {
-                /* Check message content - expecting "open" */
-                if (strncmp(event->data, "open", event->data_len) == 0) {
-                    open_entry_gate();
-                }
-            } else if (strncmp(event->topic, MQTT_TOPIC_EXIT, event->topic_len) == 0) {
-                /* Check message content - expecting "open" */
-                if (strncmp(event->data, "open", event->data_len) == 0) {
-                    open_exit_gate();
-                }
-            }
+        case MQTT_EVENT_PUBLISHED:
+            journal_published(event->msg_id);
+            supervisor_published(event->msg_id);
             break;
 
         case MQTT_EVENT_ERROR:
@@ -194,39 +816,188 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     }
 }
 
+#if WIFI_FAST_CONNECT
+/* Function to load the cached association; a missing or stale blob just disables fast connect */
+static void wifi_cache_load(void)
+{
+    nvs_handle_t nvs;
+    size_t len = sizeof(wifi_cache);
+
+    if (nvs_open(WIFI_CACHE_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    wifi_cache_valid = nvs_get_blob(nvs, WIFI_CACHE_KEY, &wifi_cache, &len) == ESP_OK &&
+                       len == sizeof(wifi_cache) && wifi_cache.version == WIFI_CACHE_VERSION &&
+                       wifi_cache.ip_info.ip.addr != 0;
+    nvs_close(nvs);
+}
+
+/* Function to persist a DHCP-obtained association, only when it changed */
+static void wifi_cache_store(const esp_netif_ip_info_t *ip_info)
+{
+    wifi_cache_t cache = {
+        .version = WIFI_CACHE_VERSION,
+        .channel = wifi_connected_channel,
+        .ip_info = *ip_info,
+    };
+    nvs_handle_t nvs;
+
+    memcpy(cache.bssid, wifi_connected_bssid, sizeof(cache.bssid));
+    if (wifi_cache_valid && memcmp(&cache, &wifi_cache, sizeof(cache)) == 0) {
+        return;
+    }
+    if (nvs_open(WIFI_CACHE_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (nvs_set_blob(nvs, WIFI_CACHE_KEY, &cache, sizeof(cache)) == ESP_OK && nvs_commit(nvs) == ESP_OK) {
+        wifi_cache = cache;
+        wifi_cache_valid = true;
+        ESP_LOGI(TAG, "[INFO] Cached AP channel %u and IP lease for fast connect.", cache.channel);
+    }
+    nvs_close(nvs);
+}
+
+/* Function to aim the next association at the cached AP with its static IP (on=true),
+ * or at a full scan with DHCP (on=false). Only called while disconnected. */
+static void wifi_fast_path_set(bool on)
+{
+    wifi_config_t wifi_config;
+
+    if (on == wifi_fast_active || (on && !wifi_cache_valid)) {
+        return;
+    }
+    ESP_ERROR_CHECK(esp_wifi_get_config(WIFI_IF_STA, &wifi_config));
+    wifi_config.sta.bssid_set = on;
+    wifi_config.sta.channel = on ? wifi_cache.channel : 0;
+    wifi_config.sta.scan_method = on ? WIFI_FAST_SCAN : WIFI_ALL_CHANNEL_SCAN;
+    if (on) {
+        memcpy(wifi_config.sta.bssid, wifi_cache.bssid, sizeof(wifi_config.sta.bssid));
+    }
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+
+    if (on) {
+        esp_netif_dhcpc_stop(sta_netif);    /* Already stopped is fine */
+        ESP_ERROR_CHECK(esp_netif_set_ip_info(sta_netif, &wifi_cache.ip_info));
+        ESP_LOGI(TAG, "[INFO] Fast connect: cached AP on channel %u, IP " IPSTR ".",
+                 wifi_cache.channel, IP2STR(&wifi_cache.ip_info.ip));
+    } else {
+        esp_netif_dhcpc_start(sta_netif);
+        ESP_LOGI(TAG, "[RETRY] Cached AP unreachable, falling back to full scan and DHCP.");
+    }
+    wifi_fast_active = on;
+    wifi_fast_failures = 0;
+}
+#endif
+
+/* Retry timer callback: runs on the timer service task */
+static void wifi_retry_timer_cb(TimerHandle_t timer)
+{
+    if (__atomic_load_n(&wifi_restarting, __ATOMIC_ACQUIRE)) {
+        return;                             /* STA_START connects once the restart is done */
+    }
+    esp_wifi_connect();
+}
+
+/* Function to schedule the next association attempt with exponential backoff */
+static void wifi_schedule_retry(void)
+{
+    uint32_t delay_ms = 0;
+
+    if (wifi_retry_count > 0) {
+        uint32_t shift = wifi_retry_count - 1 < 6 ? wifi_retry_count - 1 : 6;
+        delay_ms = WIFI_RETRY_MIN_MS << shift;
+        if (delay_ms > WIFI_RETRY_MAX_MS) {
+            delay_ms = WIFI_RETRY_MAX_MS;
+        }
+    }
+    wifi_retry_count++;
+
+    if (delay_ms == 0) {
+        ESP_LOGI(TAG, "[RETRY] Connecting to WiFi...");
+        esp_wifi_connect();
+    } else {
+        ESP_LOGI(TAG, "[RETRY] Connecting to WiFi in %lu ms...", (unsigned long)delay_ms);
+        if (xTimerChangePeriod(wifi_retry_timer, pdMS_TO_TICKS(delay_ms),
+                               pdMS_TO_TICKS(WIFI_TIMER_CMD_WAIT_MS)) != pdPASS) {
+            /* Without the timer no retry would ever come; skip the backoff instead */
+            ESP_LOGW(TAG, "[WARN] Could not arm the WiFi retry timer, connecting now.");
+            esp_wifi_connect();
+        }
+    }
+}
+
 /* Function to initialise WiFi event handler */
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
     int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+        __atomic_store_n(&wifi_restarting, false, __ATOMIC_RELEASE);
         esp_wifi_connect();
+    } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifi_event_sta_connected_t *event = (wifi_event_sta_connected_t *)event_data;
+        memcpy(wifi_connected_bssid, event->bssid, sizeof(wifi_connected_bssid));
+        wifi_connected_channel = event->channel;
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        if (s_retry_num < WIFI_MAXIMUM_RETRY) {
-            esp_wifi_connect();
-            s_retry_num++;
-            ESP_LOGI(TAG, "[RETRY] Connecting to WiFi...");
+        xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        wifi_disconnects++;
+        if (__atomic_load_n(&wifi_restarting, __ATOMIC_ACQUIRE)) {
+            /* Raised by the supervisor's stop; STA_START reconnects */
+            wifi_link_up = false;
+            wifi_retry_count = 0;
+            return;
+        }
+        if (wifi_link_up) {
+            /* Link lost (e.g. AP restart): retry right away, straight at the cached AP */
+            wifi_link_up = false;
+            wifi_retry_count = 0;
+            ESP_LOGI(TAG, "[ERROR] WiFi connection lost.");
+#if WIFI_FAST_CONNECT
+            wifi_fast_path_set(true);
+#endif
         } else {
-            xEventGroupSetBits(wifi_event_group, WIFI_FAIL_BIT);
+            ESP_LOGI(TAG, "[ERROR] Failed to connect to WiFi.");
+#if WIFI_FAST_CONNECT
+            if (wifi_fast_active && ++wifi_fast_failures >= WIFI_FAST_CONNECT_ATTEMPTS) {
+                wifi_fast_path_set(false);
+            }
+#endif
         }
-        ESP_LOGI(TAG, "[ERROR] Failed to connect to WiFi.");
+        wifi_schedule_retry();
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(TAG, "[INFO] Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
-        s_retry_num = 0;
+        ESP_LOGI(TAG, "[INFO] Got IP: " IPSTR " (%s)", IP2STR(&event->ip_info.ip),
+                 wifi_fast_active ? "fast connect" : "DHCP");
+        wifi_link_up = true;
+        wifi_retry_count = 0;
+        wifi_fast_failures = 0;
+#if WIFI_FAST_CONNECT
+        if (!wifi_fast_active) {
+            wifi_cache_store(&event->ip_info);
+        }
+#endif
+        if (boot_phase_us(BOOT_PHASE_WIFI_GOT_IP) == 0) {
+            boot_mark(BOOT_PHASE_WIFI_GOT_IP);
+            ESP_LOGI(TAG, "[INFO] Connected to WiFi SSID: %s", WIFI_SSID);
+            telemetry_record_full(TELEMETRY_EVT_AFTER_WIFI_INIT, 0);
+        }
         xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        mqtt_start_when_ready();
     }
 }
 
-// Initialize WiFi
+/* Function to start WiFi without waiting for it: association continues in the
+ * background and the GOT_IP handler takes over from there */
 static void wifi_init(void)
 {
-    print_memory_stats("Before WiFi init");
+    telemetry_record_full(TELEMETRY_EVT_BEFORE_WIFI_INIT, 0);
 
-    wifi_event_group = xEventGroupCreate();
+    wifi_event_group = xEventGroupCreateStatic(&wifi_event_group_buffer);
 
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
-    esp_netif_create_default_wifi_sta();
+    sta_netif = esp_netif_create_default_wifi_sta();
+    wifi_retry_timer = xTimerCreateStatic("wifi_retry", 1, pdFALSE, NULL, wifi_retry_timer_cb,
+                                          &wifi_retry_timer_buffer);
 
     wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -251,89 +1022,171 @@ static void wifi_init(void)
             .ssid = WIFI_SSID,
             .password = WIFI_PASS,
             .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+            .scan_method = WIFI_ALL_CHANNEL_SCAN,
+            .sort_method = WIFI_CONNECT_AP_BY_SIGNAL,
+#if GATE_POWER_SAVE
+            .listen_interval = WIFI_LISTEN_INTERVAL,
+#endif
         },
     };
 
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_11B | WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N));
+#if WIFI_FAST_CONNECT
+    wifi_cache_load();
+    wifi_fast_path_set(true);
+#endif
     ESP_ERROR_CHECK(esp_wifi_start());
+#if GATE_POWER_SAVE
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MODE));
+#endif
 
-    ESP_LOGI(TAG, "[INIT] WiFi initialization completed!");
-    
-    EventBits_t bits = xEventGroupWaitBits(wifi_event_group,
-                                            WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-                                            pdFALSE,
-                                            pdFALSE,
-                                            portMAX_DELAY);
-
-    if (bits & WIFI_CONNECTED_BIT) {
-        ESP_LOGI(TAG, "[INFO] Connected to WiFi SSID: %s", WIFI_SSID);
-    } else if (bits & WIFI_FAIL_BIT) {
-        ESP_LOGI(TAG, "[ERROR] Failed to connect to WiFi SSID: %s", WIFI_SSID);
-    } else {
-        ESP_LOGE(TAG, "[WARN] Unexpected event.");
-    }
+    ESP_LOGI(TAG, "[INIT] WiFi started, associating in the background...");
+    boot_mark(BOOT_PHASE_WIFI_STARTED);
+}
+
+/* Function to load the gate configuration from NVS (gate_config.h); no blob keeps the built-in defaults */
+static void config_load(void)
+{
+    gate_config_load();
+    boot_mark(BOOT_PHASE_CONFIG_LOADED);
+}
 
-    print_memory_stats("After WiFi init");
+#if GATE_POWER_SAVE
+/* Function to enable DFS and automatic light sleep */
+static void power_init(void)
+{
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = PM_MAX_CPU_FREQ_MHZ,
+        .min_freq_mhz = PM_MIN_CPU_FREQ_MHZ,
+        .light_sleep_enable = true,
+    };
+
+    ESP_LOGI(TAG, "[INIT] Enabling power management...");
+    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
 }
+#endif
 
 /* Function to initialize servos */
 static void servo_init(void)
 {
-    print_memory_stats("Before Servo init");
+    telemetry_record_full(TELEMETRY_EVT_BEFORE_SERVO_INIT, 0);
 
     ESP_LOGI(TAG, "[INIT] Initializing servo motors...");
 
-    mcpwm_gpio_init(MCPWM_UNIT_0, MCPWM0A, SERVO_ENTRY_GPIO);
-    mcpwm_gpio_init(MCPWM_UNIT_0, MCPWM1A, SERVO_EXIT_GPIO);
-
-    mcpwm_config_t pwm_config = {
-        .frequency = 50,    /* Set 50Hz frequency = 20ms period */
-        .cmpr_a = 0,        /* Set initial duty cycle to 0% */ 
-        .cmpr_b = 0,
-        .duty_mode = MCPWM_DUTY_MODE_0,
-        .counter_mode = MCPWM_UP_COUNTER,
-    };
-
-    mcpwm_init(MCPWM_UNIT_0, MCPWM_TIMER_0, &pwm_config);
-    mcpwm_init(MCPWM_UNIT_0, MCPWM_TIMER_1, &pwm_config);
+    /* Configures every gate in the table and starts the persistent actuator task */
+    gate_init();
+    hil_init();
+    gate_control_start();
+    gate_topics_init();
 
-    /* Move servos to closed position */
-    set_servo_angle(MCPWM_UNIT_0, MCPWM_TIMER_0, SERVO_ENTRY_GPIO, GATE_CLOSED_ANGLE_1);
-    set_servo_angle(MCPWM_UNIT_0, MCPWM_TIMER_1, SERVO_EXIT_GPIO, GATE_CLOSED_ANGLE_2);
-
-    print_memory_stats("After Servo init");
+    telemetry_record_full(TELEMETRY_EVT_AFTER_SERVO_INIT, 0);
+    boot_mark(BOOT_PHASE_SERVO_READY);
 }
 
-/* Function to initialize MQTT */
+/* Function to construct the MQTT client; it is started once WiFi has an IP */
 static void mqtt_init(void)
 {
-    print_memory_stats("Before MQTT init");
+    telemetry_record_full(TELEMETRY_EVT_BEFORE_MQTT_INIT, 0);
 
     ESP_LOGI(TAG, "[INIT] Initializing MQTT client...");
 
+    /* A stable client ID is what lets the broker find our session again */
+    uint8_t mac[6];
+    ESP_ERROR_CHECK(esp_read_mac(mac, ESP_MAC_WIFI_STA));
+    snprintf(mqtt_client_id, sizeof(mqtt_client_id), MQTT_CLIENT_ID_PREFIX "%02x%02x%02x%02x%02x%02x",
+             mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    snprintf(mqtt_state_topic, sizeof(mqtt_state_topic), MQTT_TOPIC_PREFIX "%s" MQTT_TOPIC_STATE_SUFFIX,
+             mqtt_client_id);
+#if GATE_JOURNAL
+    snprintf(mqtt_journal_topic, sizeof(mqtt_journal_topic), MQTT_TOPIC_PREFIX "%s" MQTT_TOPIC_JOURNAL_SUFFIX,
+             mqtt_client_id);
+#endif
+    mqtt_config_topic_len = snprintf(mqtt_config_topic, sizeof(mqtt_config_topic),
+                                     MQTT_TOPIC_PREFIX "%s" MQTT_TOPIC_CONFIG_SUFFIX, mqtt_client_id);
+#if GATE_METRICS
+    snprintf(mqtt_metrics_topic, sizeof(mqtt_metrics_topic), MQTT_TOPIC_PREFIX "%s" MQTT_TOPIC_METRICS_SUFFIX,
+             mqtt_client_id);
+#endif
+#if GATE_SUPERVISOR
+    snprintf(mqtt_alive_topic, sizeof(mqtt_alive_topic), MQTT_TOPIC_PREFIX "%s" MQTT_TOPIC_ALIVE_SUFFIX,
+             mqtt_client_id);
+#endif
+
+    mqtt_subscriptions_load();
+
     esp_mqtt_client_config_t mqtt_cfg = {
         .broker.address.hostname = MQTT_BROKER_ADDRESS,
+#if MQTT_USE_TLS
+        .broker.address.port = MQTT_BROKER_TLS_PORT,
+        .broker.address.transport = MQTT_TRANSPORT_OVER_SSL,
+#else
         .broker.address.port = MQTT_BROKER_PORT,
         .broker.address.transport = MQTT_TRANSPORT_OVER_TCP,
+#endif
         .credentials.username = MQTT_USERNAME,
+        .credentials.client_id = mqtt_client_id,
         .credentials.authentication.password = MQTT_PASSWORD,
+        .session.disable_clean_session = MQTT_PERSISTENT_SESSION,
+#if MQTT_USE_V5
+        .session.protocol_ver = MQTT_PROTOCOL_V_5,
+#endif
+        .buffer.size = MQTT_BUFFER_SIZE,      /* Both allocated once by esp_mqtt_client_init() */
+        .buffer.out_size = MQTT_OUT_BUFFER_SIZE,
+        .task.priority = MQTT_TASK_PRIORITY,  /* See sched.h */
+        .task.stack_size = MQTT_TASK_STACK_SIZE,
+        .network.timeout_ms = MQTT_NETWORK_TIMEOUT_MS,
     };
 
+#if MQTT_USE_TLS
+    /* Our own TLS transport, so reconnects resume the session instead of a full handshake */
+    mqtt_cfg.network.transport = mqtt_tls_transport_init(broker_ca_pem_start, broker_ca_pem_end - broker_ca_pem_start,
+                                                         MQTT_TLS_COMMON_NAME);
+    if (mqtt_cfg.network.transport == NULL) {
+        /* Never fall back to clear text; the gates keep working on the local allow-list */
+        ESP_LOGE(TAG, "[ERROR] MQTT TLS transport unavailable, staying offline.");
+        return;
+    }
+#endif
+
     mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
+#if MQTT_USE_V5
+    /* In MQTT 5 a session ends at disconnect unless it is given an expiry */
+    esp_mqtt5_connection_property_config_t connect_property = {
+        .session_expiry_interval = MQTT_PERSISTENT_SESSION ? MQTT5_SESSION_EXPIRY_S : 0,
+        .receive_maximum = MQTT5_RECEIVE_MAXIMUM,
+        .topic_alias_maximum = MQTT5_TOPIC_ALIAS_MAXIMUM,
+        .maximum_packet_size = MQTT5_MAX_PACKET_SIZE,
+    };
+    ESP_ERROR_CHECK(esp_mqtt5_client_set_connect_property(mqtt_client, &connect_property));
+#endif
+    ESP_LOGI(TAG, "[INFO] MQTT client ID: %s (persistent session: %d, MQTT 5: %d)", mqtt_client_id,
+             MQTT_PERSISTENT_SESSION, MQTT_USE_V5);
     esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
-    esp_mqtt_client_start(mqtt_client);
 
-    print_memory_stats("After MQTT init");
+    telemetry_record_full(TELEMETRY_EVT_AFTER_MQTT_INIT, 0);
+    boot_mark(BOOT_PHASE_MQTT_CLIENT_READY);
+
+    xEventGroupSetBits(wifi_event_group, MQTT_CLIENT_READY_BIT);
+    mqtt_start_when_ready();
 }
 
+/* Boot pipeline: only NVS must precede WiFi (PHY calibration data lives there). WiFi
+ * associates while config, servos and the MQTT client are set up, and the client is
+ * started from the GOT_IP handler, so no step waits on the network. */
 void app_main(void)
 {
+    boot_mark(BOOT_PHASE_START);
     ESP_LOGI(TAG, "[INIT] Starting gate system...");
 
-    set_servo_angle(MCPWM_UNIT_0, MCPWM_TIMER_0, SERVO_ENTRY_GPIO, 0);
-    set_servo_angle(MCPWM_UNIT_0, MCPWM_TIMER_0, SERVO_EXIT_GPIO, 0);
+#if GATE_TELEMETRY_MQTT
+    telemetry_start(gate_name, telemetry_mqtt_sink);
+#else
+    telemetry_start(gate_name, NULL);
+#endif
+    status_start(gate_name, status_mqtt_sink);
+    memprof_init();
 
     esp_err_t ret = nvs_flash_init();
     if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
@@ -341,12 +1194,54 @@ void app_main(void)
         ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    boot_mark(BOOT_PHASE_NVS_READY);
 
+#if GATE_POWER_SAVE
+    power_init();
+#endif
+
+    memprof_begin("wifi_init");
     wifi_init();
+    memprof_end("wifi_init");
+
+    memprof_begin("config_load");
+    config_load();
+    allowlist_init();
+    memprof_end("config_load");
 
+    memprof_begin("servo_init");
     servo_init();
+    memprof_end("servo_init");
 
+#if GATE_ESPNOW
+    /* Part of the Wi-Fi setup, but frames go to the dispatch queue, which servo_init creates */
+    memprof_begin("espnow_init");
+    espnow_init(espnow_dispatch);
+    memprof_end("espnow_init");
+#endif
+
+#if GATE_JOURNAL
+    /* Before the client exists, so nothing can be spilled before the journal is mapped;
+     * the one-off partition erase on a new device also lands here */
+    memprof_begin("journal_init");
+    journal_init(journal_mqtt_sink);
+    status_set_spill(journal_append);
+    memprof_end("journal_init");
+#endif
+
+    memprof_begin("mqtt_init");
     mqtt_init();
+    memprof_end("mqtt_init");
+
+#if GATE_METRICS
+    metrics_start(metrics_collect, metrics_mqtt_sink);
+#endif
+#if GATE_SUPERVISOR
+    /* No client (the TLS transport failed) means offline by design: nothing to recover */
+    if (mqtt_client != NULL) {
+        supervisor_start(&supervisor_hooks);
+    }
+#endif
 
-    ESP_LOGI(TAG, "[INFO] Gate system READY.");
+    ESP_LOGI(TAG, "[INFO] Boot pipeline done, waiting for network...");
 }
\ No newline at end of file
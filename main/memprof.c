@@ -0,0 +1,234 @@
+#include "memprof.h"
+
+#if GATE_MEMPROF
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "esp_heap_trace.h"
+#include "heapguard.h"
+
+#if GATE_HEAP_GUARD
+#error "GATE_MEMPROF and GATE_HEAP_GUARD both define the heap allocation hooks"
+#endif
+
+/* A site is the allocating task, plus the caller where the target records one: RISC-V
+ * heap tracing keeps no backtrace (CONFIG_HEAP_TRACING_STACK_DEPTH is 0 on the C6) */
+typedef struct {
+    TaskHandle_t task;                  /* NULL for allocations from ISRs */
+    char name[configMAX_TASK_NAME_LEN]; /* Copied at first sight, the task may be gone by the report */
+    void *pc;
+    uint32_t blocks;
+    uint32_t bytes;
+} memprof_site_t;
+
+/* Allocating task of each live allocation in the active region, filled by the heap hooks */
+typedef struct {
+    void *ptr;
+    TaskHandle_t task;
+    char name[configMAX_TASK_NAME_LEN];
+} memprof_owner_t;
+
+static const struct {
+    const char *name;
+    uint32_t caps;
+} memprof_caps[] = {
+    { "default", MALLOC_CAP_DEFAULT },
+    { "internal", MALLOC_CAP_INTERNAL },
+    { "dma", MALLOC_CAP_DMA },
+};
+
+static heap_trace_record_t trace_records[MEMPROF_RECORDS];
+static memprof_site_t sites[MEMPROF_MAX_SITES];
+static memprof_owner_t owners[MEMPROF_RECORDS];
+static const char *active_region = NULL;
+static volatile bool tracing = false;
+static uint32_t skipped_regions = 0;
+static portMUX_TYPE memprof_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Allocation hook: remembers which task made each allocation while a region is traced.
+ * It must not allocate or log. */
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    TaskHandle_t task;
+
+    if (!tracing) {
+        return;
+    }
+    task = xPortInIsrContext() ? NULL : xTaskGetCurrentTaskHandle();
+
+    portENTER_CRITICAL_SAFE(&memprof_lock);
+    for (int i = 0; i < MEMPROF_RECORDS; i++) {
+        if (owners[i].ptr == NULL) {
+            owners[i].ptr = ptr;
+            owners[i].task = task;
+            strncpy(owners[i].name, task != NULL ? pcTaskGetName(task) : "isr", sizeof(owners[i].name) - 1);
+            break;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&memprof_lock);
+}
+
+/* Free hook: a freed block no longer needs an owner */
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr)
+{
+    if (!tracing || ptr == NULL) {
+        return;
+    }
+    portENTER_CRITICAL_SAFE(&memprof_lock);
+    for (int i = 0; i < MEMPROF_RECORDS; i++) {
+        if (owners[i].ptr == ptr) {
+            owners[i].ptr = NULL;
+            break;
+        }
+    }
+    portEXIT_CRITICAL_SAFE(&memprof_lock);
+}
+
+/* Function to find the owner of a traced block; NULL if the owner table overflowed */
+static const memprof_owner_t *memprof_owner(const void *ptr)
+{
+    for (int i = 0; i < MEMPROF_RECORDS; i++) {
+        if (owners[i].ptr == ptr) {
+            return &owners[i];
+        }
+    }
+    return NULL;
+}
+
+#define MEMPROF_HEAP_ALLOCATED SIZE_MAX   /* Report the heap's own allocated total */
+
+/* Function to print one row in the memory_gate_system.csv column order */
+static void memprof_row(const char *tag, const char *region, const char *suffix, uint32_t caps,
+                        size_t allocated)
+{
+    multi_heap_info_t info;
+
+    heap_caps_get_info(&info, caps);
+    printf("%s,%lu,%s%s,%lu,%lu,%lu,%lu,%lu\n",
+        tag,
+        (unsigned long)esp_log_timestamp(),
+        region, suffix,
+        (unsigned long)info.total_free_bytes,
+        (unsigned long)info.minimum_free_bytes,
+        (unsigned long)(allocated != MEMPROF_HEAP_ALLOCATED ? allocated : info.total_allocated_bytes),
+        (unsigned long)info.total_free_bytes,
+        (unsigned long)info.largest_free_block);
+}
+
+void memprof_init(void)
+{
+    ESP_ERROR_CHECK(heap_trace_init_standalone(trace_records, MEMPROF_RECORDS));
+}
+
+void memprof_begin(const char *region)
+{
+    bool free_slot;
+
+    portENTER_CRITICAL(&memprof_lock);
+    free_slot = active_region == NULL;
+    if (free_slot) {
+        active_region = region;
+    } else {
+        skipped_regions++;
+    }
+    portEXIT_CRITICAL(&memprof_lock);
+    if (!free_slot) {
+        return;
+    }
+
+    char event[48];
+    snprintf(event, sizeof(event), "Before %s", region);
+    memprof_row("MEMPROF", event, "", MALLOC_CAP_DEFAULT, MEMPROF_HEAP_ALLOCATED);
+    memset(owners, 0, sizeof(owners));
+    tracing = true;
+    /* Leak mode: allocations freed before the region ends drop out of the buffer */
+    ESP_ERROR_CHECK(heap_trace_start(HEAP_TRACE_LEAKS));
+}
+
+void memprof_end(const char *region)
+{
+    heap_trace_record_t record;
+    size_t site_count = 0;
+    uint32_t untracked = 0;
+    char event[48];
+
+    if (active_region != region) {
+        return;                         /* Region was skipped at begin */
+    }
+    ESP_ERROR_CHECK(heap_trace_stop());
+    tracing = false;
+
+    /* Group what is still held by the task that allocated it */
+    size_t count = heap_trace_get_count();
+    for (size_t i = 0; i < count; i++) {
+        const memprof_owner_t *owner;
+        void *pc = NULL;
+        size_t s;
+
+        if (heap_trace_get(i, &record) != ESP_OK || record.address == NULL) {
+            continue;
+        }
+        owner = memprof_owner(record.address);
+        if (owner == NULL) {
+            untracked += record.size;
+            continue;
+        }
+#if CONFIG_HEAP_TRACING_STACK_DEPTH > 0
+        pc = record.alloced_by[0];
+#endif
+        for (s = 0; s < site_count && (sites[s].task != owner->task || sites[s].pc != pc); s++) {
+        }
+        if (s == site_count) {
+            if (site_count == MEMPROF_MAX_SITES) {
+                untracked += record.size;
+                continue;
+            }
+            sites[site_count] = (memprof_site_t){ .task = owner->task, .pc = pc };
+            memcpy(sites[site_count].name, owner->name, sizeof(sites[site_count].name));
+            site_count++;
+        }
+        sites[s].blocks++;
+        sites[s].bytes += record.size;
+    }
+
+    snprintf(event, sizeof(event), "After %s", region);
+    memprof_row("MEMPROF", event, "", MALLOC_CAP_DEFAULT, MEMPROF_HEAP_ALLOCATED);
+    for (size_t s = 0; s < site_count; s++) {
+        char site[configMAX_TASK_NAME_LEN + 16];
+
+        if (sites[s].pc != NULL) {
+            snprintf(site, sizeof(site), "@%s/%p", sites[s].name, sites[s].pc);
+        } else {
+            snprintf(site, sizeof(site), "@%s", sites[s].name);
+        }
+        memprof_row("MEMTASK", region, site, MALLOC_CAP_DEFAULT, sites[s].bytes);
+    }
+    if (untracked != 0) {
+        memprof_row("MEMTASK", region, "@other", MALLOC_CAP_DEFAULT, untracked);
+    }
+    for (size_t c = 0; c < sizeof(memprof_caps) / sizeof(memprof_caps[0]); c++) {
+        char caps[16];
+
+        snprintf(caps, sizeof(caps), ":%s", memprof_caps[c].name);
+        memprof_row("MEMCAPS", region, caps, memprof_caps[c].caps, MEMPROF_HEAP_ALLOCATED);
+    }
+    if (count == MEMPROF_RECORDS) {
+        ESP_LOGW("MEMPROF", "[WARN] Trace buffer full in %s, raise MEMPROF_RECORDS.", region);
+    }
+    if (skipped_regions != 0) {
+        ESP_LOGW("MEMPROF", "[WARN] %lu overlapping regions skipped so far.", (unsigned long)skipped_regions);
+    }
+
+    portENTER_CRITICAL(&memprof_lock);
+    active_region = NULL;
+    portEXIT_CRITICAL(&memprof_lock);
+}
+
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+/* Memory profiler build (-DGATE_MEMPROF=1, sdkconfig.memprof for heap tracing and the
+ * heap hooks): traces every allocation inside a named region and streams, in the
+ * eight-column schema of reports/memory_gate_system.csv:
+ *   MEMPROF  "Before <region>" / "After <region>" heap snapshots
+ *   MEMTASK  "<region>@<task>" one row per allocating task still holding memory at region
+ *            end, total_allocated_bytes being the bytes it holds. Targets whose heap
+ *            tracing records a backtrace add the caller, "<region>@<task>/0x<pc>"; the
+ *            C6 does not.
+ *   MEMCAPS  "<region>:<caps>" per-capability heap statistics at region end
+ * heap_trace is global, so regions do not nest: a region begun while another is open is
+ * skipped and counted. */
+#ifndef GATE_MEMPROF
+#define GATE_MEMPROF 0
+#endif
+
+#define MEMPROF_RECORDS 128             /* Live allocations tracked per region */
+#define MEMPROF_MAX_SITES 24            /* Distinct tasks reported per region */
+
+#if GATE_MEMPROF
+
+/* Function to set up the trace buffer; call once before the first region */
+void memprof_init(void);
+
+/* Functions to open and close a named region; both must pass the same static string */
+void memprof_begin(const char *region);
+void memprof_end(const char *region);
+
+#else
+
+#define memprof_init() do { } while (0)
+#define memprof_begin(region) do { (void)(region); } while (0)
+#define memprof_end(region) do { (void)(region); } while (0)
+
+#endif
@@ -0,0 +1,125 @@
+#include "metrics.h"
+
+#if GATE_METRICS
+
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+
+#if !CONFIG_FREERTOS_USE_TRACE_FACILITY || !CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+#error "GATE_METRICS needs the FreeRTOS run time counters (sdkconfig.metrics)"
+#endif
+
+static const char *TAG = "METRICS";
+
+static metrics_collect_t collect_fn;
+static metrics_sink_t sink_fn;
+static StaticTask_t metrics_task_buffer;
+static StackType_t metrics_task_stack[METRICS_TASK_STACK_SIZE];
+
+/* Metrics task only */
+static TaskStatus_t task_status[METRICS_MAX_TASKS];
+static struct {
+    UBaseType_t number;                     /* xTaskNumber, unique for the task's lifetime */
+    uint32_t run_time;
+} previous[METRICS_MAX_TASKS];
+static UBaseType_t previous_count = 0;
+static uint32_t previous_total = 0;
+static uint8_t payload[METRICS_PAYLOAD_SIZE];
+
+/* Function to get a task's run time counter at the last snapshot, 0 if it is new */
+static uint32_t metrics_previous_run_time(UBaseType_t number)
+{
+    for (UBaseType_t i = 0; i < previous_count; i++) {
+        if (previous[i].number == number) {
+            return previous[i].run_time;
+        }
+    }
+    return 0;
+}
+
+/* Function to build one snapshot into payload; returns its length, 0 to skip it */
+static size_t metrics_build(void)
+{
+    metrics_header_t *header = (metrics_header_t *)payload;
+    metrics_task_t *tasks = (metrics_task_t *)(header + 1);
+    configRUN_TIME_COUNTER_TYPE total;
+    UBaseType_t count;
+
+    /* Suspends the scheduler while it walks the task lists; a few tens of us */
+    count = uxTaskGetSystemState(task_status, METRICS_MAX_TASKS, &total);
+    if (count == 0) {
+        return 0;                           /* More tasks than METRICS_MAX_TASKS */
+    }
+
+    /* Counters are 32-bit microseconds, so deltas survive the wrap every 71 minutes */
+    uint32_t window = (uint32_t)total - previous_total;
+
+    memset(header, 0, sizeof(*header));
+    header->version = METRICS_VERSION;
+    header->task_count = (uint8_t)count;
+    header->gate_count = GATE_COUNT;
+    header->uptime_ms = esp_log_timestamp();
+    header->window_us = window;
+    header->free_heap = esp_get_free_heap_size();
+    header->min_free_heap = esp_get_minimum_free_heap_size();
+    collect_fn(&header->counters);
+
+    for (UBaseType_t i = 0; i < count; i++) {
+        const TaskStatus_t *t = &task_status[i];
+        uint32_t delta = (uint32_t)t->ulRunTimeCounter - metrics_previous_run_time(t->xTaskNumber);
+
+        strncpy(tasks[i].name, t->pcTaskName, METRICS_TASK_NAME_LEN);
+        tasks[i].cpu_permille = window != 0 ? (uint16_t)((uint64_t)delta * 1000 / window) : 0;
+        tasks[i].stack_free = (uint16_t)t->usStackHighWaterMark;
+    }
+    for (UBaseType_t i = 0; i < count; i++) {
+        previous[i].number = task_status[i].xTaskNumber;
+        previous[i].run_time = (uint32_t)task_status[i].ulRunTimeCounter;
+    }
+    previous_count = count;
+    previous_total = (uint32_t)total;
+
+    metrics_gate_t *gates = (metrics_gate_t *)(tasks + count);
+    for (uint8_t id = 0; id < GATE_COUNT; id++) {
+        latency_stats_t stats;
+        uint16_t histogram[LATENCY_HIST_BUCKETS];
+
+        latency_get_stats(gate_latency_ring(id), LATENCY_STAGE_TOTAL, &stats);
+        latency_get_histogram(gate_latency_ring(id), LATENCY_STAGE_TOTAL, histogram);
+        memcpy(gates[id].histogram, histogram, sizeof(histogram));     /* Packed, may be unaligned */
+        gates[id].count = (uint16_t)stats.count;
+        gates[id].p99_us = stats.p99_us;
+        gates[id].max_us = stats.max_us;
+    }
+    return (size_t)((uint8_t *)(gates + GATE_COUNT) - payload);
+}
+
+/* Metrics task: one snapshot per period; a snapshot that cannot be sent is dropped,
+ * the next one still covers the CPU shares since the last that was built */
+static void metrics_task(void *pvParameters)
+{
+    TickType_t wake = xTaskGetTickCount();
+
+    for (;;) {
+        vTaskDelayUntil(&wake, pdMS_TO_TICKS(METRICS_PERIOD_MS));
+
+        size_t len = metrics_build();
+        if (len != 0) {
+            sink_fn(payload, len);
+        }
+    }
+}
+
+void metrics_start(metrics_collect_t collect, metrics_sink_t sink)
+{
+    collect_fn = collect;
+    sink_fn = sink;
+    xTaskCreateStatic(metrics_task, "metrics", METRICS_TASK_STACK_SIZE, NULL, METRICS_TASK_PRIORITY,
+                      metrics_task_stack, &metrics_task_buffer);
+    ESP_LOGI(TAG, "[INIT] Publishing metrics every %d ms.", METRICS_PERIOD_MS);
+}
+
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "gate.h"
+#include "latency.h"
+#include "sched.h"
+
+/* Periodic health snapshot (-DGATE_METRICS=1, needs sdkconfig.metrics for the FreeRTOS
+ * run time counters): per-task CPU share and stack high-water mark, queue depths, command
+ * and connection counters and per-gate latency histograms, published every
+ * METRICS_PERIOD_MS as one binary message on parking/gate/<client id>/metrics.
+ *
+ * Payload, little endian, packed:
+ *   metrics_header_t
+ *   metrics_task_t * task_count     every task, in uxTaskGetSystemState() order
+ *   metrics_gate_t * gate_count     LATENCY_STAGE_TOTAL of each gate */
+#ifndef GATE_METRICS
+#define GATE_METRICS 0
+#endif
+#ifndef METRICS_PERIOD_MS
+#define METRICS_PERIOD_MS 60000
+#endif
+
+#define METRICS_VERSION 1
+#define METRICS_MAX_TASKS 24                /* Must exceed the task count or the snapshot is skipped */
+#define METRICS_TASK_NAME_LEN 8             /* Names are truncated, not NUL-terminated when full */
+#define METRICS_TASK_STACK_SIZE 3072
+#define METRICS_TASK_PRIORITY SCHED_PRIORITY_BACKGROUND
+
+/* Counters owned by the caller, filled in by its collect callback */
+typedef struct __attribute__((packed)) {
+    uint32_t commands_mqtt;                 /* Commands parsed from MQTT */
+    uint32_t commands_espnow;               /* Commands accepted over ESP-NOW */
+    uint32_t dispatch_dropped;
+    uint32_t reassembly_dropped;
+    uint32_t espnow_rejected;
+    uint32_t mqtt_connects;
+    uint32_t mqtt_disconnects;
+    uint32_t wifi_disconnects;
+    uint8_t dispatch_queue_depth;
+    uint8_t gate_queue_depth;
+    uint8_t reserved[2];
+} metrics_counters_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t task_count;
+    uint8_t gate_count;
+    uint8_t reserved;
+    uint32_t uptime_ms;
+    uint32_t window_us;                     /* Run time the CPU shares are taken over */
+    uint32_t free_heap;
+    uint32_t min_free_heap;
+    metrics_counters_t counters;
+} metrics_header_t;
+
+typedef struct __attribute__((packed)) {
+    char name[METRICS_TASK_NAME_LEN];
+    uint16_t cpu_permille;                  /* Share of window_us spent in this task */
+    uint16_t stack_free;                    /* High-water mark: bytes never touched */
+} metrics_task_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t count;
+    uint16_t histogram[LATENCY_HIST_BUCKETS];
+    uint32_t p99_us;
+    uint32_t max_us;
+} metrics_gate_t;
+
+#define METRICS_PAYLOAD_SIZE (sizeof(metrics_header_t) + METRICS_MAX_TASKS * sizeof(metrics_task_t) + \
+                              GATE_COUNT * sizeof(metrics_gate_t))
+
+/* Fills the caller's counters; called from the metrics task */
+typedef void (*metrics_collect_t)(metrics_counters_t *counters);
+
+/* Publishes one snapshot; returns false if it was not sent (it is then skipped) */
+typedef bool (*metrics_sink_t)(const void *payload, size_t len);
+
+#if GATE_METRICS
+
+/* Function to start the metrics task */
+void metrics_start(metrics_collect_t collect, metrics_sink_t sink);
+
+#else
+
+#define metrics_start(collect, sink) do { } while (0)
+
+#endif
@@ -0,0 +1,165 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "motion.h"
+
+/* Normalised sweep position per step, Q15 (0 = start, 32768 = target) */
+#define MOTION_Q15_ONE 32768
+static uint16_t profile[GATE_SWEEP_STEPS + 1];
+
+typedef struct {
+    uint16_t from_ticks;
+    uint16_t to_ticks;
+    uint16_t ticks;                 /* Compare value currently programmed */
+    uint16_t step;                  /* Next step to write, 1..GATE_SWEEP_STEPS */
+    int64_t start_us;               /* First step of this sweep written, 0 while pending */
+} motion_state_t;
+
+static motion_state_t motion[GATE_COUNT];
+static const mcpwm_cmpr_handle_t *motion_comparators;
+static gate_mask_t motion_active;   /* Gates sweeping now */
+static gate_mask_t motion_pending;  /* Gates waiting for the current budget */
+static int64_t last_start_us;
+static portMUX_TYPE motion_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Function to compute the normalised position at fraction u of the sweep */
+static float motion_profile_at(float u)
+{
+#if GATE_MOTION_PROFILE == MOTION_PROFILE_TRAPEZOID
+    const float ta = MOTION_TRAPEZOID_ACCEL_PCT / 100.0f;
+    const float v = 1.0f / (1.0f - ta);     /* Cruise speed that covers the sweep in time */
+
+    if (u < ta) {
+        return 0.5f * v / ta * u * u;
+    } else if (u < 1.0f - ta) {
+        return v * (u - 0.5f * ta);
+    }
+    return 1.0f - 0.5f * v / ta * (1.0f - u) * (1.0f - u);
+#else
+    return u * u * u * (10.0f + u * (-15.0f + 6.0f * u));
+#endif
+}
+
+/* Function to write the next step of a gate; returns true when the sweep is complete */
+static bool motion_step(int id)
+{
+    motion_state_t *m = &motion[id];
+    int32_t delta = (int32_t)m->to_ticks - (int32_t)m->from_ticks;
+
+    m->ticks = (uint16_t)(m->from_ticks + ((delta * profile[m->step]) >> 15));
+    mcpwm_comparator_set_compare_value(motion_comparators[id], m->ticks);
+    return ++m->step > GATE_SWEEP_STEPS;
+}
+
+/* Function to check the budget and stagger for one more start; lock held */
+static bool motion_can_start(int64_t now_us)
+{
+    return __builtin_popcount(motion_active) < MOTION_MAX_CONCURRENT &&
+           now_us - last_start_us >= MOTION_STAGGER_MS * 1000LL;
+}
+
+/* Function to move a waiting gate to its first step; lock held */
+static void motion_begin(int id, int64_t now_us)
+{
+    motion_pending &= ~GATE_MASK(id);
+    motion_active |= GATE_MASK(id);
+    last_start_us = now_us;
+    motion[id].start_us = now_us;
+    if (motion_step(id)) {
+        motion_active &= ~GATE_MASK(id);
+    }
+}
+
+/* Function to promote one waiting gate if the budget and stagger allow; lock held */
+static void motion_admit(int64_t now_us)
+{
+    if (motion_pending != 0 && motion_can_start(now_us)) {
+        motion_begin(__builtin_ctz(motion_pending), now_us);
+    }
+}
+
+/* Timer empty (period start) ISR: one step for each moving gate on this timer */
+static bool IRAM_ATTR motion_on_empty(mcpwm_timer_handle_t timer, const mcpwm_timer_event_data_t *edata, void *user_ctx)
+{
+    gate_mask_t gates = (gate_mask_t)(uintptr_t)user_ctx;
+
+    portENTER_CRITICAL_ISR(&motion_lock);
+    gate_mask_t stepping = motion_active & gates;
+    while (stepping != 0) {
+        int id = __builtin_ctz(stepping);
+        stepping &= ~GATE_MASK(id);
+        if (motion_step(id)) {
+            motion_active &= ~GATE_MASK(id);
+        }
+    }
+    motion_admit(esp_timer_get_time());
+    portEXIT_CRITICAL_ISR(&motion_lock);
+
+    return false;
+}
+
+void motion_init(const mcpwm_cmpr_handle_t *comparators, const uint16_t *initial_ticks)
+{
+    motion_comparators = comparators;
+    for (int step = 0; step <= GATE_SWEEP_STEPS; step++) {
+        profile[step] = (uint16_t)(motion_profile_at((float)step / GATE_SWEEP_STEPS) * MOTION_Q15_ONE + 0.5f);
+    }
+    for (int i = 0; i < GATE_COUNT; i++) {
+        motion[i].ticks = initial_ticks[i];
+        motion[i].to_ticks = initial_ticks[i];
+    }
+}
+
+void motion_attach_timer(mcpwm_timer_handle_t timer, gate_mask_t gates)
+{
+    mcpwm_timer_event_callbacks_t callbacks = {
+        .on_empty = motion_on_empty,
+    };
+
+    ESP_ERROR_CHECK(mcpwm_timer_register_event_callbacks(timer, &callbacks, (void *)(uintptr_t)gates));
+}
+
+int64_t motion_start(int id, uint16_t target_ticks)
+{
+    gate_mask_t bit = GATE_MASK(id);
+    int64_t now_us = esp_timer_get_time();
+    int64_t start_us;
+
+    portENTER_CRITICAL(&motion_lock);
+    motion[id].from_ticks = motion[id].ticks;
+    motion[id].to_ticks = target_ticks;
+    motion[id].step = 1;
+    motion[id].start_us = 0;
+    /* A reversal mid-sweep accelerates again, so it gives up its slot and holds where it
+     * is until the budget and stagger let it start */
+    motion_active &= ~bit;
+    motion_pending |= bit;
+    if (motion_can_start(now_us)) {
+        motion_begin(id, now_us);
+    }
+    start_us = motion[id].start_us;
+    portEXIT_CRITICAL(&motion_lock);
+    return start_us;
+}
+
+int64_t motion_started_us(int id)
+{
+    int64_t start_us;
+
+    portENTER_CRITICAL(&motion_lock);
+    start_us = motion[id].start_us;
+    portEXIT_CRITICAL(&motion_lock);
+    return start_us;
+}
+
+gate_mask_t motion_busy(void)
+{
+    gate_mask_t busy;
+
+    portENTER_CRITICAL(&motion_lock);
+    busy = motion_active | motion_pending;
+    portEXIT_CRITICAL(&motion_lock);
+    return busy;
+}
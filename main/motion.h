@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include "driver/mcpwm_prelude.h"
+#include "gate.h"
+
+/* Profiles for a full open/close sweep */
+#define MOTION_PROFILE_TRAPEZOID 0      /* Constant acceleration, cruise, constant deceleration */
+#define MOTION_PROFILE_SCURVE 1         /* Minimum-jerk: smooth acceleration, no current step */
+
+#ifndef GATE_MOTION_PROFILE
+#define GATE_MOTION_PROFILE MOTION_PROFILE_SCURVE
+#endif
+#define GATE_SWEEP_MS 800               /* Duration of one sweep */
+#define GATE_SWEEP_STEPS (GATE_SWEEP_MS * SERVO_PWM_FREQUENCY_HZ / 1000)    /* One step per PWM period */
+#define MOTION_TRAPEZOID_ACCEL_PCT 25   /* Share of the sweep spent accelerating (and decelerating) */
+
+/* Peak current budget. A servo draws its peak only while accelerating and much less once
+ * it cruises, so starts are spaced by the acceleration phase: at most one gate is ever
+ * accelerating, and the budget has to hold that peak plus every other gate cruising.
+ * Gates beyond that wait for a moving one to finish. A reversal accelerates again, so
+ * it queues like a new start. */
+#define SERVO_MOVE_CURRENT_MA 700       /* Peak draw of one servo while accelerating */
+#define SERVO_CRUISE_CURRENT_MA 250     /* Draw of one servo past its acceleration phase */
+#define GATE_PEAK_CURRENT_LIMIT_MA 1000 /* Budget for all servos moving at once */
+#define MOTION_MAX_CONCURRENT (GATE_PEAK_CURRENT_LIMIT_MA > SERVO_MOVE_CURRENT_MA ? \
+                               1 + (GATE_PEAK_CURRENT_LIMIT_MA - SERVO_MOVE_CURRENT_MA) / SERVO_CRUISE_CURRENT_MA : 1)
+#if GATE_MOTION_PROFILE == MOTION_PROFILE_TRAPEZOID
+#define MOTION_STAGGER_MS (GATE_SWEEP_MS * MOTION_TRAPEZOID_ACCEL_PCT / 100)
+#else
+#define MOTION_STAGGER_MS (GATE_SWEEP_MS / 2)   /* Minimum-jerk accelerates for half the sweep */
+#endif
+
+/* Function to set up the engine; initial_ticks is each gate's current compare value */
+void motion_init(const mcpwm_cmpr_handle_t *comparators, const uint16_t *initial_ticks);
+
+/* Function to step the given gates from a timer's period (TEZ) interrupt; call before enabling it */
+void motion_attach_timer(mcpwm_timer_handle_t timer, gate_mask_t gates);
+
+/* Function to start a sweep to target_ticks from wherever the gate is now.
+ * The first step is written immediately unless the current limit holds the gate back;
+ * returns when it was written, or 0 if held back (see motion_started_us()). */
+int64_t motion_start(int id, uint16_t target_ticks);
+
+/* Function to get when the latest sweep of a gate wrote its first step, 0 while it waits */
+int64_t motion_started_us(int id);
+
+/* Function to get the gates still moving or waiting for a current slot */
+gate_mask_t motion_busy(void);
@@ -0,0 +1,306 @@
+#include "mqtt_tls.h"
+
+#if MQTT_USE_TLS
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/x509_crt.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "MQTT_TLS";
+
+/* Asks the broker for records no larger than CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN */
+#define MQTT_TLS_MAX_FRAG_LEN MBEDTLS_SSL_MAX_FRAG_LEN_4096
+
+/* There is one broker connection, so one static context serves every reconnect */
+typedef struct {
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_x509_crt ca;
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_ssl_session session;    /* From the last good handshake, offered on reconnect */
+    bool have_session;
+    const char *common_name;
+    int fd;
+} mqtt_tls_t;
+
+static mqtt_tls_t tls = { .fd = -1 };
+
+static int tls_send(void *ctx, const unsigned char *buf, size_t len)
+{
+    int n = send(*(int *)ctx, buf, len, 0);
+
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+    }
+    return n;
+}
+
+static int tls_recv(void *ctx, unsigned char *buf, size_t len)
+{
+    int n = recv(*(int *)ctx, buf, len, 0);
+
+    if (n < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+    }
+    return n == 0 ? MBEDTLS_ERR_NET_CONN_RESET : n;
+}
+
+/* Function to wait until the socket is readable or writable; >0 ready, 0 timeout, <0 error */
+static int tls_select(bool want_read, int timeout_ms)
+{
+    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    fd_set fds;
+
+    FD_ZERO(&fds);
+    FD_SET(tls.fd, &fds);
+    return select(tls.fd + 1, want_read ? &fds : NULL, want_read ? NULL : &fds, NULL,
+                  timeout_ms < 0 ? NULL : &tv);
+}
+
+/* Function to open the TCP connection; the timeout covers the SYN as well. The socket
+ * is left non-blocking for the handshake. */
+static int tls_tcp_connect(const char *host, int port, int timeout_ms)
+{
+    struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res = NULL;
+    struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    char port_str[6];
+    int fd, flags, err = -1, one = 1;
+    socklen_t err_len = sizeof(err);
+
+    snprintf(port_str, sizeof(port_str), "%d", port);
+    if (getaddrinfo(host, port_str, &hints, &res) != 0 || res == NULL) {
+        return -1;
+    }
+    fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (fd < 0) {
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    flags = fcntl(fd, F_GETFL, 0);
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    if (connect(fd, res->ai_addr, res->ai_addrlen) == 0) {
+        err = 0;
+    } else if (errno == EINPROGRESS) {
+        fd_set fds;
+
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        if (select(fd + 1, NULL, &fds, NULL, &tv) <= 0 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0) {
+            err = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (err != 0) {
+        close(fd);
+        return -1;
+    }
+
+    /* Blocking after the handshake, bounded by the timeouts; MQTT packets are small, so no Nagle */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+static int tls_connect(esp_transport_handle_t t, const char *host, int port, int timeout_ms)
+{
+    const bool offered = tls.have_session;
+    const int64_t start_us = esp_timer_get_time();
+    const int64_t deadline_us = start_us + (int64_t)timeout_ms * 1000;
+    int ret;
+
+    tls.fd = tls_tcp_connect(host, port, timeout_ms);
+    if (tls.fd < 0) {
+        ESP_LOGW(TAG, "[WARN] TCP connect to %s:%d failed.", host, port);
+        return -1;
+    }
+
+    /* Keeps the record buffers allocated by mbedtls_ssl_setup() */
+    mbedtls_ssl_session_reset(&tls.ssl);
+    mbedtls_ssl_set_hostname(&tls.ssl, tls.common_name);
+    if (offered) {
+        mbedtls_ssl_set_session(&tls.ssl, &tls.session);
+    }
+    mbedtls_ssl_set_bio(&tls.ssl, &tls.fd, tls_send, tls_recv, NULL);
+
+    /* Non-blocking, so each step waits only for what is left of the deadline */
+    for (;;) {
+        int64_t remaining_ms;
+
+        ret = mbedtls_ssl_handshake(&tls.ssl);
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            break;
+        }
+        remaining_ms = (deadline_us - esp_timer_get_time()) / 1000;
+        if (remaining_ms <= 0 || tls_select(ret == MBEDTLS_ERR_SSL_WANT_READ, (int)remaining_ms) <= 0) {
+            ret = MBEDTLS_ERR_SSL_TIMEOUT;
+            break;
+        }
+    }
+
+#if MQTT_TLS_REPORTS
+    /* TLSLOG,<log ms>,<resumption offered>,<handshake us incl. TCP connect>,<result> */
+    printf("TLSLOG,%lu,%d,%lld,%d\n", (unsigned long)esp_log_timestamp(), offered,
+           (long long)(esp_timer_get_time() - start_us), ret);
+#endif
+
+    if (ret != 0) {
+        ESP_LOGW(TAG, "[WARN] TLS handshake failed: -0x%04x", (unsigned)-ret);
+        /* Do not offer the session again: if the broker chokes on it, it always will */
+        tls.have_session = false;
+        close(tls.fd);
+        tls.fd = -1;
+        return -1;
+    }
+
+    fcntl(tls.fd, F_SETFL, fcntl(tls.fd, F_GETFL, 0) & ~O_NONBLOCK);
+
+    /* A full handshake brings a new ticket; a resumed one may refresh it */
+    mbedtls_ssl_session_free(&tls.session);
+    mbedtls_ssl_session_init(&tls.session);
+    tls.have_session = mbedtls_ssl_get_session(&tls.ssl, &tls.session) == 0;
+    return 0;
+}
+
+static int tls_poll_read(esp_transport_handle_t t, int timeout_ms)
+{
+    /* A record may already be decrypted and buffered */
+    if (mbedtls_ssl_get_bytes_avail(&tls.ssl) > 0) {
+        return 1;
+    }
+    return tls_select(true, timeout_ms);
+}
+
+static int tls_poll_write(esp_transport_handle_t t, int timeout_ms)
+{
+    return tls_select(false, timeout_ms);
+}
+
+static int tls_read(esp_transport_handle_t t, char *buffer, int len, int timeout_ms)
+{
+    int ret = tls_poll_read(t, timeout_ms);
+
+    if (ret <= 0) {
+        return ret < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;
+    }
+    ret = mbedtls_ssl_read(&tls.ssl, (unsigned char *)buffer, len);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        return ERR_TCP_TRANSPORT_CONNECTION_TIMEOUT;    /* Only part of a record so far */
+    }
+    if (ret == 0 || ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+        return ERR_TCP_TRANSPORT_CONNECTION_CLOSED_BY_FIN;
+    }
+    return ret < 0 ? ERR_TCP_TRANSPORT_CONNECTION_FAILED : ret;
+}
+
+static int tls_write(esp_transport_handle_t t, const char *buffer, int len, int timeout_ms)
+{
+    int written = 0;
+
+    while (written < len) {
+        int ret;
+
+        if (tls_select(false, timeout_ms) <= 0) {
+            return written > 0 ? written : ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+        }
+        ret = mbedtls_ssl_write(&tls.ssl, (const unsigned char *)buffer + written, len - written);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (ret < 0) {
+            return ERR_TCP_TRANSPORT_CONNECTION_FAILED;
+        }
+        written += ret;
+    }
+    return written;
+}
+
+static int tls_close(esp_transport_handle_t t)
+{
+    if (tls.fd >= 0) {
+        mbedtls_ssl_close_notify(&tls.ssl);     /* Best effort, the link may be gone */
+        close(tls.fd);
+        tls.fd = -1;
+    }
+    return 0;
+}
+
+static int tls_destroy(esp_transport_handle_t t)
+{
+    tls_close(t);
+    mbedtls_ssl_session_free(&tls.session);
+    mbedtls_ssl_free(&tls.ssl);
+    mbedtls_ssl_config_free(&tls.conf);
+    mbedtls_x509_crt_free(&tls.ca);
+    mbedtls_ctr_drbg_free(&tls.drbg);
+    mbedtls_entropy_free(&tls.entropy);
+    tls.have_session = false;
+    return 0;
+}
+
+esp_transport_handle_t mqtt_tls_transport_init(const char *ca_pem, size_t ca_pem_len, const char *common_name)
+{
+    esp_transport_handle_t t;
+    int ret;
+
+    mbedtls_ssl_init(&tls.ssl);
+    mbedtls_ssl_config_init(&tls.conf);
+    mbedtls_x509_crt_init(&tls.ca);
+    mbedtls_entropy_init(&tls.entropy);
+    mbedtls_ctr_drbg_init(&tls.drbg);
+    mbedtls_ssl_session_init(&tls.session);
+    tls.common_name = common_name;
+
+    ret = mbedtls_ctr_drbg_seed(&tls.drbg, mbedtls_entropy_func, &tls.entropy, NULL, 0);
+    if (ret == 0) {
+        ret = mbedtls_x509_crt_parse(&tls.ca, (const unsigned char *)ca_pem, ca_pem_len);
+    }
+    if (ret == 0) {
+        ret = mbedtls_ssl_config_defaults(&tls.conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                          MBEDTLS_SSL_PRESET_DEFAULT);
+    }
+    if (ret != 0) {
+        ESP_LOGE(TAG, "[ERROR] TLS setup failed: -0x%04x", (unsigned)-ret);
+        return NULL;
+    }
+
+    mbedtls_ssl_conf_authmode(&tls.conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&tls.conf, &tls.ca, NULL);
+    mbedtls_ssl_conf_rng(&tls.conf, mbedtls_ctr_drbg_random, &tls.drbg);
+    mbedtls_ssl_conf_min_tls_version(&tls.conf, MBEDTLS_SSL_VERSION_TLS1_2);
+    mbedtls_ssl_conf_max_tls_version(&tls.conf, MBEDTLS_SSL_VERSION_TLS1_2);
+    mbedtls_ssl_conf_session_tickets(&tls.conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#ifdef MBEDTLS_SSL_MAX_FRAGMENT_LENGTH
+    mbedtls_ssl_conf_max_frag_len(&tls.conf, MQTT_TLS_MAX_FRAG_LEN);
+#endif
+
+    /* The only allocation of the record buffers for the life of the client */
+    ret = mbedtls_ssl_setup(&tls.ssl, &tls.conf);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "[ERROR] TLS context allocation failed: -0x%04x", (unsigned)-ret);
+        return NULL;
+    }
+
+    t = esp_transport_init();
+    if (t == NULL) {
+        return NULL;
+    }
+    esp_transport_set_func(t, tls_connect, tls_read, tls_write, tls_close, tls_poll_read, tls_poll_write, tls_destroy);
+    return t;
+}
+
+#endif
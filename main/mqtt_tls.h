@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include "esp_transport.h"
+
+/* MQTTS transport with TLS session resumption, for esp-mqtt's network.transport.
+ *
+ * esp-tls builds and frees a whole mbedTLS context per connection and always does a
+ * full handshake, so every reconnect costs an ECDHE exchange plus certificate chain
+ * verification and tens of KB of heap churn. This transport keeps one context for the
+ * client's lifetime: the record buffers are allocated once at init (sized by
+ * CONFIG_MBEDTLS_SSL_IN/OUT_CONTENT_LEN, see sdkconfig.tls), a reconnect only calls
+ * mbedtls_ssl_session_reset(), and the session (ticket or ID) of the last good
+ * handshake is offered again, which turns the reconnect into an abbreviated
+ * handshake: one round trip, no certificate, no key exchange.
+ *
+ * Pinned to TLS 1.2: 1.3 resumption needs tickets that arrive after the handshake and
+ * a PSK exchange, for no latency gain on a LAN broker. TCP connect and handshake share
+ * one deadline, esp-mqtt's network timeout, so a stalled broker never holds the client
+ * lock longer than a plain TCP transport would.
+ *
+ * Selected with -DMQTT_USE_TLS=1 (the tls env); the broker CA goes in main/certs/broker_ca.pem. */
+#ifndef MQTT_USE_TLS
+#define MQTT_USE_TLS 0
+#endif
+
+/* Set to 1 to print TLSLOG,<log ms>,<resumption offered 0/1>,<handshake us>,<mbedtls
+ * result> after every handshake, for measuring resumption */
+#ifndef MQTT_TLS_REPORTS
+#define MQTT_TLS_REPORTS 0
+#endif
+
+#if MQTT_USE_TLS
+
+/* Function to build the transport; ca_pem must be NUL-terminated (EMBED_TXTFILES does that)
+ * and common_name is the name the broker certificate must carry. Returns NULL on failure. */
+esp_transport_handle_t mqtt_tls_transport_init(const char *ca_pem, size_t ca_pem_len, const char *common_name);
+
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+/* Scheduling plan. The C6 has one core, so every task shares it and priority is the whole
+ * plan: the highest ready task runs, equal priorities round-robin on each tick. From the
+ * top:
+ *
+ *   23  wifi            ESP-IDF Wi-Fi driver, also runs the ESP-NOW receive callback
+ *   20  sys_evt         default event loop (Wi-Fi and IP handlers)
+ *   18  tcpip_thread    lwIP
+ *    8  gate_control    routes decoded commands; above the actuator so a burst is
+ *                       queued whole and the actuator moves it as one batch
+ *    7  gate_actuator   starts sweeps and hold windows; never yields to the network
+ *                       above MQTT, so its latency does not depend on broker traffic
+ *    6  Tmr Svc         close timers and the status flush timer (CONFIG_FREERTOS_TIMER_TASK_PRIORITY);
+ *                       never waits for the MQTT client lock
+ *    6  supervisor      watchdog and heartbeats; above MQTT so a flood cannot starve it
+ *                       into a false reboot
+ *    5  mqtt_task       esp-mqtt; the task that runs long under load (parsing a flood)
+ *    4  status          formats and enqueues state batches, woken by the flush timer;
+ *                       below MQTT since the enqueue takes the client lock
+ *    3  recovery        the supervisor's reconnects and Wi-Fi restarts, off the watchdog
+ *    2  journal         flash work, only while no gate moves; so do allowlist and
+ *                       espnow_save, which persist sync results and replay counters
+ *    1  telemetry, metrics, heapguard
+ *
+ * The sweeps themselves are stepped from the MCPWM period interrupt, so a gate already
+ * moving never waits for a task. The IDF network tasks stay above ours: they run in
+ * short bursts and everything we receive passes through them first.
+ *
+ * Affinity: with a single core there is nothing to pin, so tasks are created unpinned
+ * and CONFIG_MQTT_TASK_CORE_SELECTION_ENABLED stays off. On a dual-core part the plan
+ * would be network on core 0, gate tasks on core 1. */
+#define SCHED_PRIORITY_GATE_CONTROL 8
+#define SCHED_PRIORITY_GATE_ACTUATOR 7
+#define SCHED_PRIORITY_TIMER CONFIG_FREERTOS_TIMER_TASK_PRIORITY
+#define SCHED_PRIORITY_SUPERVISOR 6
+#define SCHED_PRIORITY_STATUS 4
+#define SCHED_PRIORITY_RECOVERY 3
+#define SCHED_PRIORITY_JOURNAL 2
+#define SCHED_PRIORITY_BACKGROUND 1
+
+/* esp-mqtt task, set through esp_mqtt_client_config_t so it needs no custom sdkconfig */
+#ifndef MQTT_TASK_PRIORITY
+#define MQTT_TASK_PRIORITY 5
+#endif
+#ifndef MQTT_TASK_STACK_SIZE
+#define MQTT_TASK_STACK_SIZE 6144       /* esp-mqtt's default */
+#endif
+
+_Static_assert(SCHED_PRIORITY_GATE_CONTROL > SCHED_PRIORITY_GATE_ACTUATOR, "Control batches for the actuator");
+_Static_assert(SCHED_PRIORITY_GATE_ACTUATOR > SCHED_PRIORITY_TIMER, "Actuator first");
+_Static_assert(SCHED_PRIORITY_TIMER > MQTT_TASK_PRIORITY, "Close timers must not wait for MQTT (sdkconfig.defaults)");
+_Static_assert(SCHED_PRIORITY_SUPERVISOR > MQTT_TASK_PRIORITY, "Supervisor must not wait for MQTT");
+_Static_assert(MQTT_TASK_PRIORITY > SCHED_PRIORITY_STATUS, "Status publishing below MQTT");
+_Static_assert(MQTT_TASK_PRIORITY > SCHED_PRIORITY_JOURNAL, "Background work below MQTT");
+_Static_assert(SCHED_PRIORITY_GATE_CONTROL < configMAX_PRIORITIES, "Priority out of range");
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "status.h"
+
+static const char *event_names[STATUS_EVT_COUNT] = {
+    [STATUS_EVT_OPEN] = "open",
+    [STATUS_EVT_CLOSED] = "closed",
+    [STATUS_EVT_ACK] = "ack",
+    [STATUS_EVT_BUSY] = "busy",
+    [STATUS_EVT_ALLOW] = "allow",
+    [STATUS_EVT_DENY] = "deny",
+    [STATUS_EVT_RESYNC] = "resync",
+    [STATUS_EVT_CONFIG] = "config",
+};
+
+typedef struct {
+    uint32_t timestamp_ms;
+    uint32_t request_id;
+    uint8_t gate;
+    uint8_t event;
+    bool has_request_id;
+} status_record_t;
+
+static status_record_t ring[STATUS_RING_SIZE];
+static uint32_t ring_head = 0;              /* Next slot to write */
+static uint32_t ring_tail = 0;              /* Next slot to publish */
+static uint32_t dropped = 0;
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static status_gate_name_t gate_name_fn = NULL;
+static status_sink_t sink_fn = NULL;
+static status_spill_t spill_fn = NULL;
+static TimerHandle_t flush_timer;
+static StaticTimer_t flush_timer_buffer;
+static TaskHandle_t status_task_handle;
+static StaticTask_t status_task_buffer;
+static StackType_t status_task_stack[STATUS_TASK_STACK_SIZE];
+static char payload[STATUS_PAYLOAD_SIZE];   /* Only touched by the status task */
+
+/* Function to format pending events as "<gate>,<event>,<request id>,<ms>" lines and hand
+ * them to the sink as a single message; status task only */
+static void status_flush(void)
+{
+    uint32_t head, tail, first, lost;
+    size_t len = 0;
+
+    portENTER_CRITICAL(&ring_lock);
+    head = ring_head;
+    first = tail = ring_tail;
+    lost = dropped;
+    portEXIT_CRITICAL(&ring_lock);
+
+#if STATUS_REPORT_HEAP
+    if (tail != head) {
+        len += snprintf(payload, sizeof(payload), "*,heap,%lu,%lu\n",
+                        (unsigned long)esp_get_minimum_free_heap_size(), (unsigned long)esp_log_timestamp());
+    }
+#endif
+    if (lost != 0) {
+        len += snprintf(payload + len, sizeof(payload) - len, "*,dropped,%lu,%lu\n",
+                        (unsigned long)lost, (unsigned long)esp_log_timestamp());
+    }
+    for (; tail != head; tail++) {
+        const status_record_t *r = &ring[tail % STATUS_RING_SIZE];
+        const char *gate = r->gate == STATUS_GATE_DEVICE ? "*" : gate_name_fn(r->gate);
+        char id[12] = "";
+        int n;
+
+        if (r->has_request_id) {
+            snprintf(id, sizeof(id), "%lu", (unsigned long)r->request_id);
+        }
+        n = snprintf(payload + len, sizeof(payload) - len, "%s,%s,%s,%lu\n",
+                     gate, event_names[r->event], id, (unsigned long)r->timestamp_ms);
+        if (n < 0 || (size_t)n >= sizeof(payload) - len) {
+            break;                          /* Rest goes out with the next flush */
+        }
+        len += n;
+    }
+
+    if (len == 0) {
+        return;                             /* Nothing pending: the timer stays dormant */
+    }
+    if (!sink_fn(payload, len)) {
+        if (spill_fn == NULL) {
+            /* Not connected: records or a dropped count are pending, keep them and retry */
+            xTimerChangePeriod(flush_timer, pdMS_TO_TICKS(STATUS_FLUSH_MS), 0);
+            return;
+        }
+        /* Not connected: the spill keeps the events, so the ring never fills during an
+         * outage; the dropped count stays for the next message that gets through */
+        for (tail = first; tail != head; tail++) {
+            const status_record_t *r = &ring[tail % STATUS_RING_SIZE];
+            spill_fn(r->gate, (status_event_t)r->event, r->has_request_id, r->request_id, r->timestamp_ms);
+        }
+        lost = 0;
+    }
+
+    portENTER_CRITICAL(&ring_lock);
+    ring_tail = tail;
+    dropped -= lost;
+    head = ring_head;
+    portEXIT_CRITICAL(&ring_lock);
+
+    if (head != tail) {
+        xTimerChangePeriod(flush_timer, pdMS_TO_TICKS(STATUS_FLUSH_MS), 0);
+    }
+}
+
+/* Flush timer callback: only wakes the status task. The sink takes the MQTT client
+ * lock, and the timer service task must never wait for it: the close timers run there. */
+static void status_flush_timer(TimerHandle_t timer)
+{
+    xTaskNotifyGive(status_task_handle);
+}
+
+static void status_task(void *pvParameters)
+{
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        status_flush();
+    }
+}
+
+void status_start(status_gate_name_t gate_name, status_sink_t sink)
+{
+    gate_name_fn = gate_name;
+    sink_fn = sink;
+    status_task_handle = xTaskCreateStatic(status_task, "status", STATUS_TASK_STACK_SIZE, NULL,
+                                           STATUS_TASK_PRIORITY, status_task_stack, &status_task_buffer);
+    flush_timer = xTimerCreateStatic("status_flush", pdMS_TO_TICKS(STATUS_FLUSH_MS), pdFALSE,
+                                     NULL, status_flush_timer, &flush_timer_buffer);
+}
+
+void status_set_spill(status_spill_t spill)
+{
+    spill_fn = spill;
+}
+
+void status_post(uint8_t gate, status_event_t event, bool has_request_id, uint32_t request_id)
+{
+    status_record_t record = {
+        .timestamp_ms = esp_log_timestamp(),
+        .request_id = request_id,
+        .gate = gate,
+        .event = (uint8_t)event,
+        .has_request_id = has_request_id,
+    };
+    uint32_t pending = 0;
+
+    portENTER_CRITICAL(&ring_lock);
+    if (ring_head - ring_tail < STATUS_RING_SIZE) {
+        ring[ring_head % STATUS_RING_SIZE] = record;
+        ring_head++;
+        pending = ring_head - ring_tail;
+    } else {
+        dropped++;
+    }
+    portEXIT_CRITICAL(&ring_lock);
+
+    /* The first pending event arms the flush, a full batch pulls it forward; the timer
+     * stays dormant while nothing is pending, so an idle gate causes no wake-ups */
+    if (pending == 1) {
+        xTimerChangePeriod(flush_timer, pdMS_TO_TICKS(STATUS_FLUSH_MS), 0);
+    } else if (pending == STATUS_FLUSH_THRESHOLD) {
+        xTimerChangePeriod(flush_timer, 1, 0);
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sched.h"
+
+/* Gate state and command acknowledgements, coalesced into one MQTT message per flush */
+#define STATUS_RING_SIZE 32                 /* Events buffered before new ones are dropped */
+#define STATUS_FLUSH_MS 200                 /* Longest an event waits before it is published */
+#define STATUS_FLUSH_THRESHOLD 16           /* Publish at once when this many are pending */
+#define STATUS_PAYLOAD_SIZE 512             /* One line per event, see status_flush() */
+#define STATUS_TASK_STACK_SIZE 3072
+#define STATUS_TASK_PRIORITY SCHED_PRIORITY_STATUS
+
+/* Set to 1 (the bench env does) to lead every payload with the heap low-water mark */
+#ifndef STATUS_REPORT_HEAP
+#define STATUS_REPORT_HEAP 0
+#endif
+
+typedef enum {
+    STATUS_EVT_OPEN,                        /* Gate is opening or open (also a status reply) */
+    STATUS_EVT_CLOSED,                      /* Gate is closing or closed (also a status reply) */
+    STATUS_EVT_ACK,                         /* Command accepted by the actuator */
+    STATUS_EVT_BUSY,                        /* Command dropped, dispatch or actuator queue full */
+    STATUS_EVT_ALLOW,                       /* Pass accepted from the local allow-list */
+    STATUS_EVT_DENY,                        /* Pass refused, credential not on the list */
+    STATUS_EVT_RESYNC,                      /* Allow-list needs a full sync; id is its seq */
+    STATUS_EVT_CONFIG,                      /* Config update handled; id is the seq in force */
+    STATUS_EVT_COUNT,
+} status_event_t;
+
+/* Gate id for events about the whole controller, printed as "*" */
+#define STATUS_GATE_DEVICE 0xff
+
+/* Publishes one coalesced payload; returning false keeps the events for the next flush */
+typedef bool (*status_sink_t)(const char *payload, size_t len);
+
+/* Takes events the sink could not publish, e.g. into flash; called from the status task */
+typedef void (*status_spill_t)(uint8_t gate, status_event_t event, bool has_request_id, uint32_t request_id,
+                               uint32_t timestamp_ms);
+
+/* Maps a gate id to the name used in the payload */
+typedef const char *(*status_gate_name_t)(uint8_t gate);
+
+/* Function to set up the ring, its flush timer and the status task that runs the sink */
+void status_start(status_gate_name_t gate_name, status_sink_t sink);
+
+/* Function to hand unpublishable events to spill instead of holding them in the ring */
+void status_set_spill(status_spill_t spill);
+
+/* Function to queue an event without blocking; request_id is only sent if has_request_id */
+void status_post(uint8_t gate, status_event_t event, bool has_request_id, uint32_t request_id);
@@ -0,0 +1,237 @@
+#include "supervisor.h"
+
+#if GATE_SUPERVISOR
+
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_attr.h"
+#include "esp_task_wdt.h"
+#include "motion.h"
+
+static const char *TAG = "SUPERVISOR";
+
+typedef enum {
+    SUPERVISOR_MQTT_UP,
+    SUPERVISOR_MQTT_OFFLINE,                /* Disconnected: outage, or Wi-Fi down */
+    SUPERVISOR_MQTT_WEDGED,                 /* Connected, heartbeat unanswered */
+} supervisor_mqtt_t;
+
+typedef enum {
+    SUPERVISOR_HEALTHY,
+    SUPERVISOR_RECONNECTED,                 /* Client reconnect issued */
+    SUPERVISOR_WIFI_RESTARTED,              /* Wi-Fi restart issued */
+} supervisor_level_t;
+
+#define SUPERVISOR_ACTION_RECONNECT 0x01
+#define SUPERVISOR_ACTION_WIFI_RESTART 0x02
+
+static const supervisor_hooks_t *hooks_fn;
+static StaticTask_t supervisor_task_buffer;
+static StackType_t supervisor_task_stack[SUPERVISOR_TASK_STACK_SIZE];
+static TaskHandle_t recovery_task_handle;
+static StaticTask_t recovery_task_buffer;
+static StackType_t recovery_task_stack[SUPERVISOR_RECOVERY_STACK_SIZE];
+static volatile bool recovery_busy = false;
+
+static volatile int ping_msg_id = -1;       /* Heartbeat waiting for its PUBACK, -1 if none */
+static uint32_t ping_sent_ms = 0;           /* Supervisor task only from here on */
+static uint32_t unhealthy_since_ms = 0;     /* 0 while healthy */
+static supervisor_level_t level = SUPERVISOR_HEALTHY;
+
+/* Supervisor reboots since the last healthy check, kept over the reboots themselves */
+#define SUPERVISOR_RTC_MAGIC 0x53555056u    /* "SUPV" */
+typedef struct {
+    uint32_t magic;
+    uint32_t reboots;
+    uint32_t check;                         /* ~reboots, catches stale or partially written state */
+} supervisor_rtc_t;
+static RTC_NOINIT_ATTR supervisor_rtc_t supervisor_rtc;
+
+static void supervisor_rtc_save(uint32_t reboots)
+{
+    supervisor_rtc.reboots = reboots;
+    supervisor_rtc.check = ~reboots;
+    supervisor_rtc.magic = SUPERVISOR_RTC_MAGIC;
+}
+
+/* Function to get the reboot count: 0 unless this is our own restart, or a watchdog or
+ * panic reset right after one */
+static uint32_t supervisor_rtc_restore(void)
+{
+    switch (esp_reset_reason()) {
+        case ESP_RST_SW:
+        case ESP_RST_PANIC:
+        case ESP_RST_INT_WDT:
+        case ESP_RST_TASK_WDT:
+        case ESP_RST_WDT:
+            break;
+        default:
+            return 0;
+    }
+    if (supervisor_rtc.magic != SUPERVISOR_RTC_MAGIC || supervisor_rtc.check != ~supervisor_rtc.reboots) {
+        return 0;
+    }
+    return supervisor_rtc.reboots;
+}
+
+/* Function to get how long a local wedge may last before the next reboot */
+static uint32_t supervisor_reboot_ms(void)
+{
+    uint32_t reboots = supervisor_rtc.reboots;
+
+    return (uint32_t)SUPERVISOR_REBOOT_MS << (reboots < SUPERVISOR_REBOOT_BACKOFF_MAX ? reboots
+                                                                                     : SUPERVISOR_REBOOT_BACKOFF_MAX);
+}
+
+/* Function to reboot once no gate is moving; the gates' state is already in RTC memory */
+static void supervisor_reboot(uint32_t unhealthy_ms)
+{
+    for (int waited = 0; motion_busy() != 0 && waited < SUPERVISOR_REBOOT_WAIT_MS; waited += 100) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+        supervisor_beat();
+    }
+    ESP_LOGE(TAG, "[ERROR] MQTT connected but unanswered for %lu s, rebooting (%lu in a row).",
+             (unsigned long)(unhealthy_ms / 1000), (unsigned long)supervisor_rtc.reboots + 1);
+    supervisor_rtc_save(supervisor_rtc.reboots + 1);
+    esp_restart();
+}
+
+/* Function to hand a recovery step to the recovery task; never blocks */
+static void supervisor_recover(uint32_t action)
+{
+    if (recovery_busy) {
+        ESP_LOGW(TAG, "[WARN] Previous recovery step still running, escalating anyway.");
+    }
+    xTaskNotify(recovery_task_handle, action, eSetBits);
+}
+
+/* Recovery task: runs the blocking steps, a Wi-Fi restart covering a reconnect */
+static void supervisor_recovery_task(void *pvParameters)
+{
+    uint32_t actions;
+
+    for (;;) {
+        xTaskNotifyWait(0, UINT32_MAX, &actions, portMAX_DELAY);
+        recovery_busy = true;
+        if (actions & SUPERVISOR_ACTION_WIFI_RESTART) {
+            hooks_fn->wifi_restart();
+        } else if (actions & SUPERVISOR_ACTION_RECONNECT) {
+            hooks_fn->reconnect();
+        }
+        recovery_busy = false;
+    }
+}
+
+/* Function to check MQTT end to end, sending the next heartbeat when due */
+static supervisor_mqtt_t supervisor_mqtt_state(uint32_t now)
+{
+    if (!hooks_fn->mqtt_connected()) {
+        ping_msg_id = -1;
+        return SUPERVISOR_MQTT_OFFLINE;
+    }
+    if (ping_msg_id >= 0) {
+        /* Connected but silent: half-open TCP or a stuck client. Without Wi-Fi the client
+         * is about to notice, and that is no local wedge. */
+        if (now - ping_sent_ms < SUPERVISOR_PING_TIMEOUT_MS) {
+            return SUPERVISOR_MQTT_UP;
+        }
+        return hooks_fn->wifi_up() ? SUPERVISOR_MQTT_WEDGED : SUPERVISOR_MQTT_OFFLINE;
+    }
+    if (now - ping_sent_ms >= SUPERVISOR_PING_MS) {
+        int msg_id = hooks_fn->ping();
+
+        if (msg_id < 0) {
+            /* Outbox full or out of memory: unhealthy until an enqueue succeeds, retried
+             * every beat. With Wi-Fi up that is the client itself, so a local wedge. */
+            return hooks_fn->wifi_up() ? SUPERVISOR_MQTT_WEDGED : SUPERVISOR_MQTT_OFFLINE;
+        }
+        ping_sent_ms = now;
+        ping_msg_id = msg_id;
+    }
+    return SUPERVISOR_MQTT_UP;
+}
+
+/* Function to run one check and take the next escalation step when it is due */
+static void supervisor_check(void)
+{
+    uint32_t now = esp_log_timestamp();
+    supervisor_mqtt_t state = supervisor_mqtt_state(now);
+    uint32_t unhealthy_ms;
+
+    if (state == SUPERVISOR_MQTT_UP) {
+        if (level != SUPERVISOR_HEALTHY) {
+            ESP_LOGI(TAG, "[INFO] MQTT healthy again.");
+        }
+        if (supervisor_rtc.reboots != 0) {
+            supervisor_rtc_save(0);
+        }
+        unhealthy_since_ms = 0;
+        level = SUPERVISOR_HEALTHY;
+        return;
+    }
+    if (unhealthy_since_ms == 0) {
+        unhealthy_since_ms = now != 0 ? now : 1;
+    }
+    unhealthy_ms = now - unhealthy_since_ms;
+
+    if (state == SUPERVISOR_MQTT_WEDGED && unhealthy_ms >= supervisor_reboot_ms()) {
+        supervisor_reboot(unhealthy_ms);
+    } else if (unhealthy_ms >= SUPERVISOR_WIFI_RESTART_MS && level < SUPERVISOR_WIFI_RESTARTED) {
+        ESP_LOGW(TAG, "[WARN] MQTT unhealthy for %lu s, restarting Wi-Fi.", (unsigned long)(unhealthy_ms / 1000));
+        level = SUPERVISOR_WIFI_RESTARTED;
+        ping_msg_id = -1;
+        supervisor_recover(SUPERVISOR_ACTION_WIFI_RESTART);
+    } else if (unhealthy_ms >= SUPERVISOR_RECONNECT_MS && level < SUPERVISOR_RECONNECTED && hooks_fn->wifi_up()) {
+        /* Without an IP a reconnect cannot help, wait for the Wi-Fi step instead */
+        ESP_LOGW(TAG, "[WARN] MQTT unhealthy for %lu s, reconnecting.", (unsigned long)(unhealthy_ms / 1000));
+        level = SUPERVISOR_RECONNECTED;
+        ping_msg_id = -1;
+        supervisor_recover(SUPERVISOR_ACTION_RECONNECT);
+    }
+}
+
+/* Supervisor task: feeds its own watchdog slot, then checks, once per beat */
+static void supervisor_task(void *pvParameters)
+{
+    supervisor_watch();
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(SUPERVISOR_BEAT_MS));
+        supervisor_beat();
+        supervisor_check();
+    }
+}
+
+void supervisor_start(const supervisor_hooks_t *hooks)
+{
+    hooks_fn = hooks;
+    supervisor_rtc_save(supervisor_rtc_restore());
+    if (supervisor_rtc.reboots != 0) {
+        ESP_LOGW(TAG, "[WARN] Up after %lu supervisor reboots, next one after %lu min.",
+                 (unsigned long)supervisor_rtc.reboots, (unsigned long)(supervisor_reboot_ms() / 60000));
+    }
+    recovery_task_handle = xTaskCreateStatic(supervisor_recovery_task, "recovery", SUPERVISOR_RECOVERY_STACK_SIZE,
+                                             NULL, SUPERVISOR_RECOVERY_PRIORITY, recovery_task_stack,
+                                             &recovery_task_buffer);
+    xTaskCreateStatic(supervisor_task, "supervisor", SUPERVISOR_TASK_STACK_SIZE, NULL, SUPERVISOR_TASK_PRIORITY,
+                      supervisor_task_stack, &supervisor_task_buffer);
+}
+
+void supervisor_watch(void)
+{
+    ESP_ERROR_CHECK(esp_task_wdt_add(NULL));
+}
+
+void supervisor_beat(void)
+{
+    esp_task_wdt_reset();
+}
+
+void supervisor_published(int msg_id)
+{
+    if (msg_id == ping_msg_id) {
+        ping_msg_id = -1;
+    }
+}
+
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "sched.h"
+
+/* Health supervisor: keeps a wedged unit from sitting with its lanes closed until someone
+ * power cycles it.
+ *
+ * - Gate tasks: the actuator and control tasks are on the task watchdog and never block
+ *   longer than SUPERVISOR_BEAT_MS between resets; a hung one panics and reboots
+ *   (CONFIG_ESP_TASK_WDT_PANIC in sdkconfig.defaults).
+ * - MQTT: esp-mqtt's task loop has no hook to feed the watchdog, so the supervisor checks
+ *   it end to end instead: every SUPERVISOR_PING_MS it enqueues a QoS 1 heartbeat on
+ *   parking/gate/<client id>/alive and expects the PUBACK in SUPERVISOR_PING_TIMEOUT_MS,
+ *   so the MQTT task itself has to send it. The supervisor is on the watchdog, so an MQTT
+ *   task that hangs holding the client lock takes it down too.
+ * - While MQTT is unhealthy it escalates: client reconnect, then a Wi-Fi restart. Only a
+ *   local wedge, Wi-Fi up and the client connected but the heartbeat unanswered, goes on
+ *   to a soft reboot once no gate is moving. A broker or WAN outage shows as a disconnected
+ *   client, which a reboot cannot fix, so it never reboots. Reboots in a row are counted
+ *   in RTC memory and each one doubles the wait for the next, up to
+ *   SUPERVISOR_REBOOT_BACKOFF_MAX times, so a wedge a reboot does not cure cannot loop.
+ *
+ * Gate positions survive software and watchdog reboots in RTC memory (gate.c), so
+ * a reboot neither moves nor pulses an open gate closed. */
+#ifndef GATE_SUPERVISOR
+#define GATE_SUPERVISOR 1
+#endif
+
+#define SUPERVISOR_BEAT_MS 1000                 /* Longest wait of a watched task */
+#define SUPERVISOR_PING_MS 30000
+#define SUPERVISOR_PING_TIMEOUT_MS 10000
+#define SUPERVISOR_RECONNECT_MS 30000           /* Unhealthy this long: reconnect the client */
+#define SUPERVISOR_WIFI_RESTART_MS 120000       /* ... restart Wi-Fi */
+#define SUPERVISOR_REBOOT_MS 600000             /* ... reboot, if the wedge is local */
+#define SUPERVISOR_REBOOT_BACKOFF_MAX 3         /* Doublings of the reboot wait: 10 to 80 min */
+#define SUPERVISOR_REBOOT_WAIT_MS 3000          /* Longest wait for moving gates before the reboot */
+#define SUPERVISOR_TASK_STACK_SIZE 2560
+#define SUPERVISOR_TASK_PRIORITY SCHED_PRIORITY_SUPERVISOR
+#define SUPERVISOR_RECOVERY_STACK_SIZE 3072
+#define SUPERVISOR_RECOVERY_PRIORITY SCHED_PRIORITY_RECOVERY
+
+/* Hooks into the network code in main.c. The supervisor task is on the watchdog, so it
+ * only calls the first three, which never block longer than the MQTT network timeout.
+ * The recovery steps can block for as long as esp-mqtt or the Wi-Fi driver likes, so they
+ * run on a recovery task that is not watched; one still stuck is skipped over and the
+ * escalation goes on. */
+typedef struct {
+    bool (*wifi_up)(void);                  /* Associated with an IP */
+    bool (*mqtt_connected)(void);
+    int (*ping)(void);                      /* Enqueue a heartbeat; MQTT message ID or -1 */
+    void (*reconnect)(void);                /* Recovery task */
+    void (*wifi_restart)(void);             /* Recovery task */
+} supervisor_hooks_t;
+
+#if GATE_SUPERVISOR
+
+/* Function to start the supervisor task; only once the MQTT client exists */
+void supervisor_start(const supervisor_hooks_t *hooks);
+
+/* Function to put the calling task on the task watchdog */
+void supervisor_watch(void);
+
+/* Function to feed the watchdog from a watched task */
+void supervisor_beat(void);
+
+/* Function called from the MQTT event handler for every PUBACK */
+void supervisor_published(int msg_id);
+
+/* Longest a watched task may block: ticks, capped to the beat */
+#define SUPERVISOR_WAIT(ticks) ((ticks) < pdMS_TO_TICKS(SUPERVISOR_BEAT_MS) ? (ticks) : pdMS_TO_TICKS(SUPERVISOR_BEAT_MS))
+
+#else
+
+#define supervisor_start(hooks) do { (void)(hooks); } while (0)
+#define supervisor_watch() do { } while (0)
+#define supervisor_beat() do { } while (0)
+#define supervisor_published(msg_id) do { } while (0)
+#define SUPERVISOR_WAIT(ticks) (ticks)
+
+#endif
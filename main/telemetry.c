@@ -0,0 +1,160 @@
+#include "telemetry.h"
+
+#if GATE_TELEMETRY_ENABLED
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+
+static const char *event_formats[TELEMETRY_EVT_COUNT] = {
+    [TELEMETRY_EVT_BEFORE_WIFI_INIT] = "Before WiFi init",
+    [TELEMETRY_EVT_AFTER_WIFI_INIT] = "After WiFi init",
+    [TELEMETRY_EVT_BEFORE_SERVO_INIT] = "Before Servo init",
+    [TELEMETRY_EVT_AFTER_SERVO_INIT] = "After Servo init",
+    [TELEMETRY_EVT_BEFORE_MQTT_INIT] = "Before MQTT init",
+    [TELEMETRY_EVT_AFTER_MQTT_INIT] = "After MQTT init",
+    [TELEMETRY_EVT_BEFORE_GATE_OPEN] = "Before open %s gate",
+    [TELEMETRY_EVT_AFTER_GATE_CLOSE] = "After close %s gate",
+};
+
+static telemetry_record_t ring[TELEMETRY_RING_SIZE];
+static uint32_t ring_head = 0;              /* Next slot to write */
+static uint32_t ring_tail = 0;              /* Next slot to drain */
+static uint32_t dropped = 0;
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static telemetry_arg_name_t arg_name_fn = NULL;
+static telemetry_sink_t sink_fn = NULL;
+static StaticTask_t telemetry_task_buffer;
+static StackType_t telemetry_task_stack[TELEMETRY_TASK_STACK_SIZE];
+
+static void ring_push(const telemetry_record_t *record)
+{
+    portENTER_CRITICAL(&ring_lock);
+    if (ring_head - ring_tail < TELEMETRY_RING_SIZE) {
+        ring[ring_head % TELEMETRY_RING_SIZE] = *record;
+        ring_head++;
+    } else {
+        dropped++;
+    }
+    portEXIT_CRITICAL(&ring_lock);
+}
+
+static size_t ring_pop(telemetry_record_t *out, size_t max)
+{
+    size_t count = 0;
+
+    portENTER_CRITICAL(&ring_lock);
+    while (count < max && ring_tail != ring_head) {
+        out[count++] = ring[ring_tail % TELEMETRY_RING_SIZE];
+        ring_tail++;
+    }
+    portEXIT_CRITICAL(&ring_lock);
+    return count;
+}
+
+static void fill_record(telemetry_record_t *record, telemetry_event_t event, uint8_t arg)
+{
+    uint32_t free_heap = esp_get_free_heap_size();
+
+    record->timestamp_ms = esp_log_timestamp();
+    record->event = (uint8_t)event;
+    record->arg = arg;
+    record->flags = 0;
+    record->reserved = 0;
+    record->free_heap = free_heap;
+    record->min_free_heap = esp_get_minimum_free_heap_size();
+    record->total_allocated_bytes = heap_caps_get_total_size(MALLOC_CAP_DEFAULT) - free_heap;
+    record->largest_free_block = 0;
+}
+
+void telemetry_record(telemetry_event_t event, uint8_t arg)
+{
+    telemetry_record_t record;
+
+    fill_record(&record, event, arg);
+    ring_push(&record);
+}
+
+void telemetry_record_full(telemetry_event_t event, uint8_t arg)
+{
+    telemetry_record_t record;
+    multi_heap_info_t info;
+
+    fill_record(&record, event, arg);
+    heap_caps_get_info(&info, MALLOC_CAP_DEFAULT);
+    record.total_allocated_bytes = info.total_allocated_bytes;
+    record.largest_free_block = info.largest_free_block;
+    record.flags |= TELEMETRY_FLAG_FULL;
+    ring_push(&record);
+}
+
+void telemetry_print_record(const telemetry_record_t *record)
+{
+    char event[40];
+    const char *arg_name = arg_name_fn != NULL ? arg_name_fn(record->arg) : "?";
+
+    if (record->event < TELEMETRY_EVT_COUNT) {
+        snprintf(event, sizeof(event), event_formats[record->event], arg_name);
+    } else {
+        snprintf(event, sizeof(event), "Event %u", record->event);
+    }
+
+    printf("MEMLOG,%lu,%s,%lu,%lu,%lu,%lu,%lu\n",
+        (unsigned long)record->timestamp_ms,
+        event,
+        (unsigned long)record->free_heap,
+        (unsigned long)record->min_free_heap,
+        (unsigned long)record->total_allocated_bytes,
+        (unsigned long)record->free_heap,
+        (unsigned long)record->largest_free_block);
+}
+
+/* Drain task: empties the ring in batches at low priority, off every hot path */
+static void telemetry_task(void *pvParameters)
+{
+    telemetry_record_t batch[TELEMETRY_BATCH_SIZE];
+    uint32_t reported_dropped = 0;
+
+    for (;;) {
+        size_t count;
+
+        while ((count = ring_pop(batch, TELEMETRY_BATCH_SIZE)) > 0) {
+            /* Hot-path records skipped the heap walk; sample fragmentation here instead */
+            size_t largest_free_block = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+            for (size_t i = 0; i < count; i++) {
+                if (!(batch[i].flags & TELEMETRY_FLAG_FULL)) {
+                    batch[i].largest_free_block = largest_free_block;
+                }
+            }
+
+            if (sink_fn == NULL || !sink_fn(batch, count)) {
+                for (size_t i = 0; i < count; i++) {
+                    telemetry_print_record(&batch[i]);
+                }
+            }
+        }
+
+        if (dropped != reported_dropped) {
+            reported_dropped = dropped;
+            ESP_LOGW("TELEMETRY", "[WARN] Telemetry ring full, %lu records dropped so far.",
+                     (unsigned long)reported_dropped);
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(TELEMETRY_DRAIN_PERIOD_MS));
+    }
+}
+
+void telemetry_start(telemetry_arg_name_t arg_name, telemetry_sink_t sink)
+{
+    arg_name_fn = arg_name;
+    sink_fn = sink;
+    xTaskCreateStatic(telemetry_task, "telemetry", TELEMETRY_TASK_STACK_SIZE, NULL,
+                      TELEMETRY_TASK_PRIORITY, telemetry_task_stack, &telemetry_task_buffer);
+}
+
+#endif
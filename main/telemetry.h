@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sched.h"
+
+/* Set to 0 (e.g. -DGATE_TELEMETRY_ENABLED=0 in build_flags) to compile telemetry out */
+#ifndef GATE_TELEMETRY_ENABLED
+#define GATE_TELEMETRY_ENABLED 1
+#endif
+
+#define TELEMETRY_RING_SIZE 64              /* Records buffered before new ones are dropped */
+#define TELEMETRY_BATCH_SIZE 16             /* Records handed to the sink per call */
+#define TELEMETRY_DRAIN_PERIOD_MS 500       /* How often the drain task empties the ring */
+#define TELEMETRY_TASK_STACK_SIZE 3072
+#define TELEMETRY_TASK_PRIORITY SCHED_PRIORITY_BACKGROUND
+
+typedef enum {
+    TELEMETRY_EVT_BEFORE_WIFI_INIT,
+    TELEMETRY_EVT_AFTER_WIFI_INIT,
+    TELEMETRY_EVT_BEFORE_SERVO_INIT,
+    TELEMETRY_EVT_AFTER_SERVO_INIT,
+    TELEMETRY_EVT_BEFORE_MQTT_INIT,
+    TELEMETRY_EVT_AFTER_MQTT_INIT,
+    TELEMETRY_EVT_BEFORE_GATE_OPEN,         /* arg: gate id */
+    TELEMETRY_EVT_AFTER_GATE_CLOSE,         /* arg: gate id */
+    TELEMETRY_EVT_COUNT,
+} telemetry_event_t;
+
+/* Set when largest_free_block was sampled at record time rather than by the drain task */
+#define TELEMETRY_FLAG_FULL 0x01
+
+/* Wire format of one record, also used for batched MQTT publishing */
+typedef struct __attribute__((packed)) {
+    uint32_t timestamp_ms;
+    uint8_t event;
+    uint8_t arg;
+    uint8_t flags;
+    uint8_t reserved;
+    uint32_t free_heap;
+    uint32_t min_free_heap;
+    uint32_t total_allocated_bytes;
+    uint32_t largest_free_block;
+} telemetry_record_t;
+
+/* Receives drained records; returning false falls back to the serial MEMLOG output */
+typedef bool (*telemetry_sink_t)(const telemetry_record_t *records, size_t count);
+
+/* Maps a record arg (gate id) to the name used in MEMLOG events */
+typedef const char *(*telemetry_arg_name_t)(uint8_t arg);
+
+#if GATE_TELEMETRY_ENABLED
+
+/* Start the drain task; a NULL sink prints MEMLOG lines on the serial console */
+void telemetry_start(telemetry_arg_name_t arg_name, telemetry_sink_t sink);
+
+/* Cheap record for hot paths: O(1) heap counters only, no heap walk, no I/O */
+void telemetry_record(telemetry_event_t event, uint8_t arg);
+
+/* Full record for init checkpoints: also walks the heap for fragmentation data */
+void telemetry_record_full(telemetry_event_t event, uint8_t arg);
+
+/* Print a record as a MEMLOG line */
+void telemetry_print_record(const telemetry_record_t *record);
+
+#else
+
+#define telemetry_start(arg_name, sink) do { (void)(arg_name); (void)(sink); } while (0)
+#define telemetry_record(event, arg) do { } while (0)
+#define telemetry_record_full(event, arg) do { } while (0)
+
+#endif
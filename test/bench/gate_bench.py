@@ -0,0 +1,254 @@
+#!/usr/bin/env python3
+"""Load generator and ack latency benchmark for the gate firmware.
+
+Fires bursts of "open@<request id>" commands at parking/gate/<lane> and matches
+them against the acks the firmware publishes on parking/gate/<client id>/state.
+Flash the esp32-c6-devkitc-1-bench env so every state message also carries the
+heap low-water mark.
+
+With --flood-rate every run is repeated while a second client floods the lane
+wildcard with junk at that rate, saturating Wi-Fi, lwIP and the esp-mqtt task; the
+scheduling plan in main/sched.h should keep actuation latency flat regardless. Ack
+latency includes the network, so for the on-device figure also build with
+-DGATE_METRICS=1 -DMETRICS_PERIOD_MS=5000: the per-gate actuation histograms from
+parking/gate/<client id>/metrics are recorded per phase.
+
+Writes CSVs for the reports/ notebook:
+  bench_gate_system.csv          one row per command: ack latency or how it was lost
+  bench_heap_gate_system.csv     firmware heap low-water mark over the run
+  bench_metrics_gate_system.csv  on-device actuation latency per metrics snapshot
+
+Requires paho-mqtt (pip install paho-mqtt).
+"""
+
+import argparse
+import csv
+import random
+import struct
+import threading
+import time
+
+import paho.mqtt.client as mqtt
+
+# Defaults match mqtt_init() in main/main.c
+BROKER = "138.199.217.16"
+PORT = 1883
+USERNAME = "parkers"
+PASSWORD = "parkers"
+TOPIC_PREFIX = "parking/gate/"
+
+# Metrics payload layout, see main/metrics.h
+METRICS_HEADER = struct.Struct("<BBBBIIII8I4B")
+METRICS_TASK = struct.Struct("<8sHH")
+METRICS_GATE = struct.Struct("<H8HII")
+
+
+class Flood(threading.Thread):
+    """Publishes QoS 0 junk at a fixed rate to a lane topic no gate answers to"""
+
+    def __init__(self, args):
+        super().__init__(daemon=True)
+        self.args = args
+        self.running = threading.Event()
+        self.sent = 0
+        self.client = mqtt.Client(client_id=f"gate-flood-{random.getrandbits(32):08x}")
+        self.client.username_pw_set(args.username, args.password)
+        self.client.connect(args.broker, args.port, keepalive=30)
+        self.client.loop_start()
+        self.start()
+
+    def run(self):
+        payload = bytes(random.getrandbits(8) for _ in range(self.args.flood_size))
+        period = 1.0 / self.args.flood_rate
+        while True:
+            self.running.wait()
+            self.client.publish(self.args.flood_topic, payload, qos=0)
+            self.sent += 1
+            time.sleep(period)
+
+
+class Bench:
+    def __init__(self, args):
+        self.args = args
+        self.lock = threading.Lock()
+        self.pending = {}       # request id -> row
+        self.rows = []
+        self.heap = []
+        self.metrics = []
+        self.phase = "idle"
+        self.connected = threading.Event()
+        self.subscribed = threading.Event()
+        self.t0 = time.monotonic()
+
+        self.client = mqtt.Client(client_id=f"gate-bench-{random.getrandbits(32):08x}")
+        self.client.username_pw_set(args.username, args.password)
+        self.client.on_connect = self.on_connect
+        self.client.on_subscribe = self.on_subscribe
+        self.client.on_message = self.on_message
+
+    def now_ms(self):
+        return (time.monotonic() - self.t0) * 1000.0
+
+    def on_connect(self, client, userdata, flags, rc):
+        self.connected.set()
+        client.subscribe(f"{TOPIC_PREFIX}{self.args.device}/state", qos=1)
+        client.subscribe(f"{TOPIC_PREFIX}{self.args.device}/metrics", qos=0)
+
+    def on_subscribe(self, client, userdata, mid, granted_qos):
+        self.subscribed.set()
+
+    def on_metrics(self, rx_ms, payload):
+        if len(payload) < METRICS_HEADER.size:
+            return
+        header = METRICS_HEADER.unpack_from(payload)
+        version, task_count, gate_count = header[0:3]
+        if version != 1:
+            return
+        offset = METRICS_HEADER.size + task_count * METRICS_TASK.size
+        for gate in range(gate_count):
+            if offset + METRICS_GATE.size > len(payload):
+                return
+            fields = METRICS_GATE.unpack_from(payload, offset)
+            offset += METRICS_GATE.size
+            self.metrics.append({"host_ms": round(rx_ms, 1), "phase": self.phase, "gate": gate,
+                                 "count": fields[0], "p99_us": fields[9], "max_us": fields[10],
+                                 "histogram": ";".join(str(n) for n in fields[1:9])})
+
+    def on_message(self, client, userdata, msg):
+        rx_ms = self.now_ms()
+        if msg.topic.endswith("/metrics"):
+            self.on_metrics(rx_ms, msg.payload)
+            return
+        # One line per event: <gate>,<event>,<request id>,<device ms>
+        for line in msg.payload.decode(errors="replace").splitlines():
+            fields = line.split(",")
+            if len(fields) != 4:
+                continue
+            gate, event, value, device_ms = fields
+            if gate == "*" and event == "heap":
+                self.heap.append({"host_ms": round(rx_ms, 1), "device_ms": device_ms,
+                                  "min_free_heap": value})
+                continue
+            if event not in ("ack", "busy") or not value:
+                continue
+            with self.lock:
+                row = self.pending.pop(int(value), None)
+            if row is None:
+                continue
+            row["result"] = event
+            row["ack_ms"] = round(rx_ms, 1)
+            row["latency_ms"] = round(rx_ms - row["sent_ms"], 1)
+
+    def run(self):
+        args = self.args
+        self.client.connect(args.broker, args.port, keepalive=30)
+        self.client.loop_start()
+        if not self.connected.wait(10) or not self.subscribed.wait(10):
+            raise SystemExit("Could not connect/subscribe to the broker")
+
+        flood = Flood(args) if args.flood_rate else None
+        request_id = random.getrandbits(24)
+        for phase in self.phases():
+            self.phase = phase
+            if flood:
+                if phase == "flood":
+                    flood.running.set()
+                else:
+                    flood.running.clear()
+            for qos in args.qos:
+                for burst in range(args.bursts):
+                    for n in range(args.burst_size):
+                        lane = args.lanes[n % len(args.lanes)]
+                        request_id += 1
+                        row = {"phase": phase, "qos": qos, "burst": burst, "lane": lane,
+                               "request_id": request_id, "sent_ms": round(self.now_ms(), 1),
+                               "ack_ms": "", "latency_ms": "", "result": "lost"}
+                        with self.lock:
+                            self.pending[request_id] = row
+                        self.rows.append(row)
+                        self.client.publish(f"{TOPIC_PREFIX}{lane}", f"open@{request_id}", qos=qos)
+                        if args.spacing_ms:
+                            time.sleep(args.spacing_ms / 1000.0)
+                    time.sleep(args.interval_ms / 1000.0)
+        if flood:
+            flood.running.clear()
+            print(f"Flood: {flood.sent} messages of {args.flood_size} bytes")
+
+        # Anything still pending after the timeout counts as lost
+        time.sleep(args.timeout_ms / 1000.0)
+        self.client.loop_stop()
+        self.client.disconnect()
+
+    def phases(self):
+        return ["idle", "flood"] if self.args.flood_rate else ["idle"]
+
+    def write(self):
+        fields = ["phase", "qos", "burst", "lane", "request_id", "sent_ms", "ack_ms", "latency_ms", "result"]
+        with open(self.args.out, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=fields)
+            writer.writeheader()
+            writer.writerows(self.rows)
+        with open(self.args.heap_out, "w", newline="") as f:
+            writer = csv.DictWriter(f, fieldnames=["host_ms", "device_ms", "min_free_heap"])
+            writer.writeheader()
+            writer.writerows(self.heap)
+        if self.metrics:
+            with open(self.args.metrics_out, "w", newline="") as f:
+                writer = csv.DictWriter(f, fieldnames=["host_ms", "phase", "gate", "count", "p99_us",
+                                                       "max_us", "histogram"])
+                writer.writeheader()
+                writer.writerows(self.metrics)
+
+    def summary(self):
+        for phase in self.phases():
+            for qos in self.args.qos:
+                rows = [r for r in self.rows if r["qos"] == qos and r["phase"] == phase]
+                acked = sorted(r["latency_ms"] for r in rows if r["result"] == "ack")
+                busy = sum(1 for r in rows if r["result"] == "busy")
+                lost = sum(1 for r in rows if r["result"] == "lost")
+                p50 = acked[len(acked) // 2] if acked else float("nan")
+                p99 = acked[min(len(acked) - 1, int(len(acked) * 0.99))] if acked else float("nan")
+                print(f"{phase} QoS {qos}: {len(rows)} sent, {len(acked)} acked, {busy} busy, {lost} lost, "
+                      f"p50 {p50} ms, p99 {p99} ms")
+            # The last snapshot of a phase covers the most recent opens of that phase
+            last = {}
+            for m in self.metrics:
+                if m["phase"] == phase:
+                    last[m["gate"]] = m
+            for gate, m in sorted(last.items()):
+                print(f"{phase} gate {gate}: actuation p99 {m['p99_us']} us, max {m['max_us']} us "
+                      f"over {m['count']} opens")
+        if self.heap:
+            print(f"Heap low-water mark: {min(int(h['min_free_heap']) for h in self.heap)} bytes")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--device", required=True, help="firmware MQTT client ID, e.g. gate-a0b1c2d3e4f5")
+    parser.add_argument("--broker", default=BROKER)
+    parser.add_argument("--port", type=int, default=PORT)
+    parser.add_argument("--username", default=USERNAME)
+    parser.add_argument("--password", default=PASSWORD)
+    parser.add_argument("--lanes", default="entry,exit", type=lambda s: s.split(","))
+    parser.add_argument("--qos", default="0,1", type=lambda s: [int(q) for q in s.split(",")])
+    parser.add_argument("--bursts", type=int, default=20)
+    parser.add_argument("--burst-size", type=int, default=10, help="commands per burst")
+    parser.add_argument("--spacing-ms", type=float, default=0, help="gap between commands in a burst")
+    parser.add_argument("--interval-ms", type=float, default=2000, help="gap between bursts")
+    parser.add_argument("--timeout-ms", type=float, default=3000, help="wait for late acks at the end")
+    parser.add_argument("--out", default="bench_gate_system.csv")
+    parser.add_argument("--heap-out", default="bench_heap_gate_system.csv")
+    parser.add_argument("--metrics-out", default="bench_metrics_gate_system.csv")
+    parser.add_argument("--flood-rate", type=float, default=0, help="junk messages per second, 0 for no flood phase")
+    parser.add_argument("--flood-size", type=int, default=512, help="bytes per junk message")
+    parser.add_argument("--flood-topic", default=f"{TOPIC_PREFIX}flood", help="matches the lane wildcard, no gate")
+    args = parser.parse_args()
+
+    bench = Bench(args)
+    bench.run()
+    bench.write()
+    bench.summary()
+
+
+if __name__ == "__main__":
+    main()
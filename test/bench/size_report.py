@@ -0,0 +1,160 @@
+#!/usr/bin/env python3
+"""Image size and RAM comparison between two firmware builds.
+
+Reads the captured build-and-monitor output of each build (the way
+reports/full_gate_system.log was recorded: `pio run -t upload -t monitor`, or
+`idf.py build flash monitor`, piped through tee), then prints flash and RAM side by
+side with the difference:
+
+  app / bootloader image   "... binary size 0x... bytes" lines from the build
+  static RAM / flash       PlatformIO "RAM:" / "Flash:" summary lines, when present
+  heap at READY            BOOTHEAP row (free heap and low-water mark), in every build
+  heap per phase           MEMLOG rows, only in builds with telemetry
+  boot time                BOOTLOG rows, when the firmware prints them
+
+The release env compiles telemetry out, so compare it on the BOOTHEAP rows: capture
+the baseline from the default env with the same firmware revision, since older logs
+such as reports/full_gate_system.log predate BOOTHEAP.
+
+Typical use, baseline from the default env against the release env:
+
+  pio run -e esp32-c6-devkitc-1 -t upload -t monitor | tee default.log
+  pio run -e esp32-c6-devkitc-1-release-minimal -t upload -t monitor | tee release.log
+  python3 test/bench/size_report.py --baseline default.log --candidate release.log \
+      --csv size_gate_system.csv
+
+--min-free-pct makes it a size gate: it exits non-zero when either build leaves less
+than that share of the factory partition (partitions.csv) free.
+"""
+
+import argparse
+import csv
+import re
+
+APP_RE = re.compile(r"(\S+\.bin) binary size 0x([0-9a-fA-F]+) bytes\. Smallest app partition is "
+                    r"0x([0-9a-fA-F]+) bytes\. 0x([0-9a-fA-F]+) bytes \((\d+)%\) free")
+BOOTLOADER_RE = re.compile(r"Bootloader binary size 0x([0-9a-fA-F]+) bytes\. 0x([0-9a-fA-F]+) bytes")
+PIO_RE = re.compile(r"^(RAM|Flash):\s+\[.*\]\s+[\d.]+% \(used (\d+) bytes from (\d+) bytes\)")
+
+
+def parse_log(path):
+    """Returns {metric: bytes or us} for one captured log; missing metrics are absent"""
+    values = {}
+    heap_events = []
+    min_free = None
+
+    with open(path, errors="replace") as f:
+        for line in f:
+            line = line.strip()
+            m = APP_RE.search(line)
+            if m and "app_bytes" not in values:
+                values["app_bytes"] = int(m.group(2), 16)
+                values["app_partition_bytes"] = int(m.group(3), 16)
+                values["app_free_bytes"] = int(m.group(4), 16)
+                continue
+            m = BOOTLOADER_RE.search(line)
+            if m and "bootloader_bytes" not in values:
+                values["bootloader_bytes"] = int(m.group(1), 16)
+                continue
+            m = PIO_RE.match(line)
+            if m:
+                values["static_" + m.group(1).lower() + "_bytes"] = int(m.group(2))
+                continue
+            # MEMLOG,<ms>,<event>,<free>,<min free>,<allocated>,<total free>,<largest block>
+            if line.startswith("MEMLOG,"):
+                fields = line.split(",")
+                if len(fields) < 8:
+                    continue
+                event = "heap_free " + fields[2]
+                if event not in values:
+                    values[event] = int(fields[3])
+                    heap_events.append(event)
+                low = int(fields[4])
+                min_free = low if min_free is None else min(min_free, low)
+                continue
+            # BOOTHEAP,<ms>,<free>,<min free>
+            if line.startswith("BOOTHEAP,"):
+                fields = line.split(",")
+                if len(fields) >= 4 and "ready_heap_free" not in values:
+                    values["ready_heap_free"] = int(fields[2])
+                    values["ready_heap_min_free"] = int(fields[3])
+                continue
+            # BOOTLOG,<ms>,<phase>,<us since boot>
+            if line.startswith("BOOTLOG,"):
+                fields = line.split(",")
+                if len(fields) >= 4 and "boot_us " + fields[2] not in values:
+                    values["boot_us " + fields[2]] = int(fields[3])
+
+    if min_free is not None:
+        values["heap_min_free"] = min_free
+    values["_heap_events"] = heap_events
+    return values
+
+
+def compare(baseline, candidate):
+    """Rows of (metric, baseline, candidate, delta) in a stable order"""
+    order = ["app_bytes", "app_free_bytes", "app_partition_bytes", "bootloader_bytes",
+             "static_flash_bytes", "static_ram_bytes", "ready_heap_free", "ready_heap_min_free"]
+    order += [e for e in baseline["_heap_events"] if e in candidate]
+    order += ["heap_min_free"]
+    order += sorted(k for k in baseline if k.startswith("boot_us ") and k in candidate)
+
+    rows = []
+    for key in order:
+        base = baseline.get(key)
+        cand = candidate.get(key)
+        if base is None and cand is None:
+            continue
+        delta = cand - base if base is not None and cand is not None else None
+        rows.append((key, base, cand, delta))
+    return rows
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--baseline", default="reports/full_gate_system.log",
+                        help="log of the reference build (default: %(default)s)")
+    parser.add_argument("--candidate", required=True, help="log of the build to compare")
+    parser.add_argument("--csv", help="also write the comparison as CSV for the reports/ notebook")
+    parser.add_argument("--min-free-pct", type=int,
+                        help="fail if either app image leaves less of its partition free")
+    args = parser.parse_args()
+
+    baseline, candidate = parse_log(args.baseline), parse_log(args.candidate)
+    rows = compare(baseline, candidate)
+    if not rows:
+        raise SystemExit("No size or heap lines found in either log")
+
+    def cell(v):
+        return "-" if v is None else str(v)
+
+    width = max(len(r[0]) for r in rows)
+    print(f"{'metric':<{width}}  {'baseline':>10}  {'candidate':>10}  {'delta':>10}")
+    for key, base, cand, delta in rows:
+        print(f"{key:<{width}}  {cell(base):>10}  {cell(cand):>10}  "
+              f"{'-' if delta is None else f'{delta:+d}':>10}")
+
+    if args.csv:
+        with open(args.csv, "w", newline="") as f:
+            writer = csv.writer(f)
+            writer.writerow(["metric", "baseline", "candidate", "delta"])
+            for row in rows:
+                writer.writerow(["" if v is None else v for v in row])
+
+    if args.min_free_pct is not None:
+        failed = False
+        for name, values in (("baseline", baseline), ("candidate", candidate)):
+            if "app_bytes" not in values:
+                print(f"{name}: no app size line, cannot check the partition margin")
+                failed = True
+                continue
+            free_pct = round(100 * values["app_free_bytes"] / values["app_partition_bytes"])
+            if free_pct < args.min_free_pct:
+                print(f"{name}: {free_pct}% of the app partition free, below {args.min_free_pct}%")
+                failed = True
+        if failed:
+            raise SystemExit(1)
+
+
+if __name__ == "__main__":
+    main()